@@ -27,6 +27,11 @@ int AlphaBeta::negamax(int depth, int alpha, int beta) {
         return UNKNOWN;
     }
 
+    //an abandoned search looks like a depth cutoff to the parents so nothing wrong gets stored
+    if (isStopped()) {
+        return UNKNOWN;
+    }
+
    /*
     if (popCount > 0) {
         assert(!whiteMoves);
@@ -59,6 +64,12 @@ int AlphaBeta::negamax(int depth, int alpha, int beta) {
 #if TRANS_ON
     int transScore = trans->fetch(currentPosition);
 
+    //a proven score may have been replaced in the table but kept in the exact store
+    if ((transScore & 1) == 0 && exact != NULL) {
+        int exactScore = exact->fetch(currentPosition);
+        if (exactScore != UNKNOWN) transScore = exactScore;
+    }
+
     //check if we have an exact score (see connect4.h)
     if (transScore & 1) {
         reusedCount++;
@@ -81,6 +92,11 @@ int AlphaBeta::negamax(int depth, int alpha, int beta) {
     }
 #endif
 
+    int endgameScore = probeEndgame();
+    if (endgameScore != UNKNOWN) {
+        return endgameScore;
+    }
+
     //Step 1: Generate successors
     Successor succ[WIDTH * 2];
     int moveCount = getSuccessors(succ);
@@ -233,6 +249,9 @@ int AlphaBeta::negamax(int depth, int alpha, int beta) {
 
     trans->store(currentPosition, bestScore, interiorCount - startNodes);
     //assert(trans->fetch(currentPosition) == bestScore);
+    if ((bestScore & 1) != 0 && exact != NULL) {
+        exact->store(currentPosition, bestScore, interiorCount - startNodes);
+    }
 #endif
 
     return bestScore;
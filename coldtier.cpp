@@ -0,0 +1,380 @@
+#include "coldtier.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Connect4;
+
+ColdTier::Run::Run() : level(0), count(0) {
+#ifdef __linux__
+    entries = NULL;
+#endif
+}
+
+ColdTier::Run::~Run() {
+#ifdef __linux__
+    if (entries != NULL) munmap((void*) entries, count * sizeof (uint64_t));
+#else
+    in.close();
+#endif
+    std::remove(file.c_str());
+}
+
+ColdTier::ColdTier(const std::string& dir, uint64_t size, int bits) : directory(dir), bloomBits(bits), nextRun(0),
+snapshot(std::make_shared<Snapshot>()), writing(false), stopping(false) {
+    shardSize = std::max(size / SHARDS, (uint64_t) 1);
+    if (bloomBits < 1) bloomBits = 1;
+    spilled = 0;
+    probes = 0;
+    blockReads = 0;
+    hits = 0;
+    writer = std::thread(&ColdTier::write, this);
+}
+
+ColdTier::~ColdTier() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+void ColdTier::reset() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        //the writer may still be busy with the last buffers
+        changed.wait(guard, [this] {
+            return !writing && (snapshot->pending.empty() || error);
+        });
+        snapshot = std::make_shared<Snapshot>();
+        error = std::exception_ptr();
+    }
+    for (int i = 0; i < SHARDS; i++) {
+        std::lock_guard<std::mutex> shardGuard(shards[i].lock);
+        shards[i].entries.clear();
+    }
+    spilled = 0;
+    probes = 0;
+    blockReads = 0;
+    hits = 0;
+}
+
+int ColdTier::getRunCount() const {
+    return getSnapshot()->runs.size();
+}
+
+std::shared_ptr<const ColdTier::Snapshot> ColdTier::getSnapshot() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return snapshot;
+}
+
+void ColdTier::spill(bitboard pos, int score, int work) {
+    assert(score > UNKNOWN && score <= WIN);
+    Shard& shard = shards[getShard(pos)];
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> shardGuard(shard.lock);
+        shard.entries[pos] = (pos << POSITION_SHIFT) | ((uint64_t) work << WORK_SHIFT) | score;
+        spilled.fetch_add(1, std::memory_order_relaxed);
+        if (shard.entries.size() >= shardSize) {
+            //published before the shard is unlocked, so a lookup finds the entries in one or the other
+            std::shared_ptr<const Batch> batch = std::make_shared<Batch>(std::move(shard.entries));
+            shard.entries.clear();
+            std::lock_guard<std::mutex> guard(lock);
+            std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot);
+            next->pending.push_back(batch);
+            snapshot = next;
+            full = true;
+        }
+    }
+    if (!full) return;
+
+    changed.notify_all();
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this] {
+        return snapshot->pending.size() < (unsigned int) MAX_PENDING || error;
+    });
+    if (error) std::rethrow_exception(error);
+}
+
+int ColdTier::fetch(bitboard pos, int& work) const {
+    if (spilled.load(std::memory_order_relaxed) == 0) return UNKNOWN;
+
+    probes.fetch_add(1, std::memory_order_relaxed);
+    uint64_t e = 0;
+    Shard& shard = shards[getShard(pos)];
+    {
+        std::lock_guard<std::mutex> shardGuard(shard.lock);
+        Batch::const_iterator buffered = shard.entries.find(pos);
+        if (buffered != shard.entries.end()) e = buffered->second;
+    }
+    if (e == 0) {
+        std::shared_ptr<const Snapshot> current = getSnapshot();
+        //newest first
+        for (int i = current->pending.size() - 1; i >= 0 && e == 0; i--) {
+            Batch::const_iterator buffered = current->pending[i]->find(pos);
+            if (buffered != current->pending[i]->end()) e = buffered->second;
+        }
+        for (int i = current->runs.size() - 1; i >= 0 && e == 0; i--) {
+            if (mayContain(*current->runs[i], pos)) e = find(*current->runs[i], pos);
+        }
+    }
+    if (e == 0) return UNKNOWN;
+
+    hits.fetch_add(1, std::memory_order_relaxed);
+    work = (e >> WORK_SHIFT) & ((1 << (POSITION_SHIFT - WORK_SHIFT)) - 1);
+    return e & ((1 << WORK_SHIFT) - 1);
+}
+
+/**
+ * The writer thread. Writes all buffers that are waiting as one run and then
+ * merges runs, publishing a new snapshot after each step.
+ */
+void ColdTier::write() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [this] {
+            return stopping || !snapshot->pending.empty();
+        });
+        if (stopping) return;
+
+        std::vector<std::shared_ptr<const Batch> > batches = snapshot->pending;
+        writing = true;
+        guard.unlock();
+        std::shared_ptr<Run> run;
+        std::exception_ptr failure;
+        try {
+            run = flush(batches);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        guard.lock();
+
+        //buffers that came in meanwhile are behind the ones written
+        std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot);
+        next->pending.erase(next->pending.begin(), next->pending.begin() + batches.size());
+        if (!failure) {
+            next->runs.push_back(run);
+        } else {
+            error = failure;
+        }
+        snapshot = next;
+        if (!failure) {
+            guard.unlock();
+            try {
+                merge();
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            guard.lock();
+            if (failure) error = failure;
+        }
+        writing = false;
+        changed.notify_all();
+    }
+}
+
+static uint64_t bloomHash(bitboard pos, int i) {
+    uint64_t h1 = pos * 0x9E3779B97F4A7C15ULL;
+    uint64_t h2 = pos * 0xC2B2AE3D27D4EB4FULL;
+    return (h1 ^ (h1 >> 29)) + i * ((h2 >> 17) | 1);
+}
+
+bool ColdTier::mayContain(const Run& run, bitboard pos) const {
+    uint64_t mask = run.bloom.size() * 64 - 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = bloomHash(pos, i) & mask;
+        if ((run.bloom[bit / 64] & ((uint64_t) 1 << (bit % 64))) == 0) return false;
+    }
+    return true;
+}
+
+/**
+ * Reads the one block that can hold the position. Returns the entry, or 0 if the
+ * run does not have it.
+ */
+uint64_t ColdTier::find(Run& run, bitboard pos) const {
+    uint64_t first = pos << POSITION_SHIFT;
+    uint64_t last = first | (((uint64_t) 1 << POSITION_SHIFT) - 1);
+    uint64_t block = std::upper_bound(run.fences.begin(), run.fences.end(), last) - run.fences.begin();
+    if (block == 0) return 0;
+    block--;
+
+    uint64_t count = std::min((uint64_t) FENCE_INTERVAL, run.count - block * FENCE_INTERVAL);
+#ifdef __linux__
+    const uint64_t* entries = run.entries + block * FENCE_INTERVAL;
+#else
+    uint64_t entries[FENCE_INTERVAL];
+    {
+        std::lock_guard<std::mutex> guard(run.readLock);
+        run.in.clear();
+        run.in.seekg(block * FENCE_INTERVAL * sizeof (uint64_t));
+        if (!run.in.read((char*) entries, count * sizeof (uint64_t))) {
+            throw std::runtime_error("Cannot read cold tier run " + run.file);
+        }
+    }
+#endif
+    blockReads.fetch_add(1, std::memory_order_relaxed);
+
+    const uint64_t* e = std::lower_bound(entries, entries + count, first);
+    return e != entries + count && *e <= last ? *e : 0;
+}
+
+/**
+ * Only called by the writer, so the run numbers need no lock
+ */
+std::shared_ptr<ColdTier::Run> ColdTier::startRun(int level, uint64_t capacity) {
+    std::shared_ptr<Run> run = std::make_shared<Run>();
+    std::ostringstream name;
+    name << directory << "/run-" << nextRun++ << ".cold";
+    run->file = name.str();
+    run->level = level;
+
+    uint64_t words = 1;
+    while (words * 64 < capacity * bloomBits) {
+        words *= 2;
+    }
+    run->bloom.assign(words, 0);
+    return run;
+}
+
+void ColdTier::append(Run& run, std::ofstream& out, uint64_t e) {
+    if (run.count % FENCE_INTERVAL == 0) {
+        run.fences.push_back(e);
+    }
+    uint64_t mask = run.bloom.size() * 64 - 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = bloomHash(e >> POSITION_SHIFT, i) & mask;
+        run.bloom[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+    out.write((const char*) &e, sizeof (e));
+    run.count++;
+}
+
+/**
+ * Closes the file that was written and opens it for lookups
+ */
+void ColdTier::openRun(Run& run, std::ofstream& out) {
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write cold tier run " + run.file);
+    }
+#ifdef __linux__
+    if (run.count == 0) return;
+    int fd = open(run.file.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Cannot open cold tier run " + run.file);
+    }
+    void* p = mmap(NULL, run.count * sizeof (uint64_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    run.entries = (const uint64_t*) p;
+#else
+    run.in.open(run.file.c_str(), std::ios::binary);
+    if (!run.in) {
+        throw std::runtime_error("Cannot open cold tier run " + run.file);
+    }
+#endif
+}
+
+/**
+ * Writes the buffers as a new run of level 0. Each buffer only has the last entry
+ * spilled for each position, and newer buffers replace older ones.
+ */
+std::shared_ptr<ColdTier::Run> ColdTier::flush(const std::vector<std::shared_ptr<const Batch> >& batches) {
+    Batch latest;
+    for (unsigned int i = 0; i < batches.size(); i++) {
+        for (Batch::const_iterator j = batches[i]->begin(); j != batches[i]->end(); ++j) {
+            latest[j->first] = j->second;
+        }
+    }
+
+    std::vector<uint64_t> sorted;
+    sorted.reserve(latest.size());
+    for (Batch::const_iterator i = latest.begin(); i != latest.end(); ++i) {
+        sorted.push_back(i->second);
+    }
+    std::sort(sorted.begin(), sorted.end(), comparePositions);
+    std::shared_ptr<Run> run = startRun(0, sorted.size());
+    std::ofstream out(run->file.c_str(), std::ios::binary | std::ios::trunc);
+    for (unsigned int i = 0; i < sorted.size(); i++) {
+        append(*run, out, sorted[i]);
+    }
+    openRun(*run, out);
+    return run;
+}
+
+/**
+ * Merges the newest runs as long as FAN_IN of them have the same level. Newer runs
+ * are always at the end and never have a higher level than older ones, so the
+ * runs to merge are the last FAN_IN. Only the writer changes the runs, so they
+ * are read from the snapshot without holding the lock while merging.
+ */
+void ColdTier::merge() {
+    while (true) {
+        std::vector<std::shared_ptr<Run> > runs = getSnapshot()->runs;
+        if (runs.size() < (unsigned int) FAN_IN) return;
+        int begin = runs.size() - FAN_IN;
+        int level = runs.back()->level;
+        if (runs[begin]->level != level) return;
+
+        uint64_t capacity = 0;
+        std::vector<std::ifstream*> inputs;
+        std::vector<uint64_t> current(FAN_IN);
+        std::vector<uint64_t> left(FAN_IN);
+        for (int i = 0; i < FAN_IN; i++) {
+            Run& run = *runs[begin + i];
+            capacity += run.count;
+            inputs.push_back(new std::ifstream(run.file.c_str(), std::ios::binary));
+            left[i] = run.count;
+            if (left[i] > 0) inputs[i]->read((char*) &current[i], sizeof (uint64_t));
+        }
+
+        std::shared_ptr<Run> merged = startRun(level + 1, capacity);
+        std::ofstream out(merged->file.c_str(), std::ios::binary | std::ios::trunc);
+        while (true) {
+            //the smallest position, from the newest run that has it
+            int best = -1;
+            for (int i = FAN_IN - 1; i >= 0; i--) {
+                if (left[i] > 0 && (best == -1 || comparePositions(current[i], current[best]))) best = i;
+            }
+            if (best == -1) break;
+
+            uint64_t pos = current[best] >> POSITION_SHIFT;
+            append(*merged, out, current[best]);
+            for (int i = 0; i < FAN_IN; i++) {
+                if (left[i] > 0 && (current[i] >> POSITION_SHIFT) == pos) {
+                    left[i]--;
+                    if (left[i] > 0) inputs[i]->read((char*) &current[i], sizeof (uint64_t));
+                }
+            }
+        }
+        bool failed = false;
+        for (int i = 0; i < FAN_IN; i++) {
+            failed |= inputs[i]->bad();
+            delete inputs[i];
+        }
+        if (failed) {
+            throw std::runtime_error("Cannot read cold tier run " + runs[begin]->file);
+        }
+        openRun(*merged, out);
+
+        //the merged runs are deleted when the last lookup in them is done
+        std::lock_guard<std::mutex> guard(lock);
+        std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(*snapshot);
+        next->runs.resize(begin);
+        next->runs.push_back(merged);
+        snapshot = next;
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef COLD_TIER_H
+#define COLD_TIER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "connect4.h"
+
+/**
+ * File-backed second level for a TransTable. Entries that the table evicts are
+ * collected in memory and written in batches as sorted runs, one file per run in
+ * the given directory. Runs are never modified: when FAN_IN runs of the same level
+ * have been written they are merged into one run of the next level, and newer runs
+ * take precedence over older ones for the same position.
+ *
+ * Each run keeps a bloom filter and every FENCE_INTERVAL-th position in memory, so
+ * a lookup reads at most one block per run that may contain the position and none
+ * for most positions that were never spilled. The run files are deleted when the
+ * tier is reset or destroyed.
+ *
+ * Spilled entries go to one of SHARDS buffers by position, each with its own lock.
+ * A full buffer is handed to a writer thread, which writes and merges runs while
+ * the search goes on. The buffers waiting to be written and the runs are published
+ * together as an immutable snapshot, so lookups in them take no lock and only
+ * copy the pointer to the snapshot. Spilling only waits when the writer falls
+ * MAX_PENDING buffers behind.
+ *
+ * The tier is only consulted after a miss in the table, and only once something
+ * has been spilled.
+ */
+class ColdTier {
+public:
+    static const uint64_t DEFAULT_BUFFER_SIZE = 1 << 20;
+    static const int DEFAULT_BLOOM_BITS = 10;
+
+private:
+    static const int FENCE_INTERVAL = 512;
+    static const int FAN_IN = 4;
+    static const int BLOOM_HASHES = 4;
+    static const int SHARDS = 16;
+    static const int MAX_PENDING = 2 * SHARDS;
+    //on disk an entry is the position followed by the work and the score
+    static const int WORK_SHIFT = 3;
+    static const int POSITION_SHIFT = 9;
+
+    //the last entry spilled for each position
+    typedef std::unordered_map<bitboard, uint64_t> Batch;
+
+    /**
+     * A run file. It is deleted with the last snapshot that has the run, so a
+     * lookup can finish in a run that a merge has replaced.
+     */
+    class Run {
+    public:
+        std::string file;
+        int level;
+        uint64_t count;
+        //the first entry of every block
+        std::vector<uint64_t> fences;
+        std::vector<uint64_t> bloom;
+#ifdef __linux__
+        const uint64_t* entries;
+#else
+        std::ifstream in;
+        std::mutex readLock;
+#endif
+
+        Run();
+        ~Run();
+    };
+
+    typedef struct {
+        //oldest first
+        std::vector<std::shared_ptr<const Batch> > pending;
+        std::vector<std::shared_ptr<Run> > runs;
+    } Snapshot;
+
+    typedef struct {
+        std::mutex lock;
+        Batch entries;
+    } Shard;
+
+    std::string directory;
+    uint64_t shardSize;
+    int bloomBits;
+    int nextRun;
+
+    mutable Shard shards[SHARDS];
+    std::shared_ptr<const Snapshot> snapshot;
+    //guards the snapshot pointer and the state of the writer
+    mutable std::mutex lock;
+    std::condition_variable changed;
+    std::thread writer;
+    bool writing;
+    bool stopping;
+    //the last error of the writer, thrown by spill until the tier is reset
+    std::exception_ptr error;
+
+    std::atomic<uint64_t> spilled;
+    mutable std::atomic<uint64_t> probes;
+    mutable std::atomic<uint64_t> blockReads;
+    mutable std::atomic<uint64_t> hits;
+
+    static bool comparePositions(uint64_t a, uint64_t b) {
+        return (a >> POSITION_SHIFT) < (b >> POSITION_SHIFT);
+    }
+
+    static int getShard(bitboard pos) {
+        return (pos * 0x9E3779B97F4A7C15ULL) >> 60;
+    }
+
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+    void write();
+    std::shared_ptr<Run> flush(const std::vector<std::shared_ptr<const Batch> >& batches);
+    void merge();
+    std::shared_ptr<Run> startRun(int level, uint64_t capacity);
+    void append(Run& run, std::ofstream& out, uint64_t e);
+    void openRun(Run& run, std::ofstream& out);
+    bool mayContain(const Run& run, bitboard pos) const;
+    uint64_t find(Run& run, bitboard pos) const;
+
+public:
+    /**
+     * The directory must exist. The buffer size is the number of entries kept in
+     * memory before they are written, split over the shards, and the bloom filters
+     * use the given number of bits per entry.
+     */
+    ColdTier(const std::string& directory, uint64_t bufferSize = DEFAULT_BUFFER_SIZE, int bloomBits = DEFAULT_BLOOM_BITS);
+    ~ColdTier();
+
+    /**
+     * Forgets all entries and deletes the run files. Must not be called while other
+     * threads are using the tier.
+     */
+    void reset();
+
+    /**
+     * Work is log2 of the nodes that were searched, as kept by the TransTable
+     */
+    void spill(bitboard pos, int score, int work);
+
+    //returns the score, or UNKNOWN if the position has not been spilled
+    int fetch(bitboard pos, int& work) const;
+
+    uint64_t getSpilled() const {
+        return spilled.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getProbes() const {
+        return probes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getBlockReads() const {
+        return blockReads.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getHits() const {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    int getRunCount() const;
+};
+
+#endif
@@ -5,9 +5,11 @@
 namespace Connect4 {
 
     int countBits(bitboard board) {
-        int bits = 0;
-        for (; board; board >>= 1) bits += board & 1;
-        return bits;
+        //pairs, nibbles and bytes are counted in parallel and the bytes summed by the multiply
+        board -= (board >> 1) & 0x5555555555555555ULL;
+        board = (board & 0x3333333333333333ULL) + ((board >> 2) & 0x3333333333333333ULL);
+        board = (board + (board >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (board * 0x0101010101010101ULL) >> 56;
     }
 
     std::string toString(bitboard current, bitboard other) {
@@ -75,6 +75,21 @@ namespace Connect4 {
         return BOTTOM + current + current + other;
     }
 
+    /**
+     * The inverse of getPosition. Each column of a position is the height bit plus
+     * the pieces of the player to move, so the bits under the height bit are taken.
+     */
+    inline void splitPosition(bitboard pos, bitboard& current, bitboard& other) {
+        //smear the height bits down their columns, the masks keep the shifts inside a column
+        bitboard smeared = pos;
+        for (int shift = 1; shift < H1; shift *= 2) {
+            smeared |= (smeared >> shift) & ((((bitboard) 1 << (H1 - shift)) - 1) * BOTTOM);
+        }
+        bitboard occupied = (smeared >> 1) & FULL;
+        current = pos & occupied;
+        other = occupied ^ current;
+    }
+
     inline bitboard getHeightBit(const bitboard& b1, const bitboard& b2, int n) {
         //TODO: check x86 BSR instruction
         bitboard both = b1 | b2;
@@ -0,0 +1,200 @@
+#include "dfpn.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+using namespace Connect4;
+
+const int PROVEN = 1;
+const int DISPROVEN = 2;
+
+const uint32_t DfPn::INF;
+
+DfPn::DfPn(uint64_t tableSize) : handicapPlyLimit(Handicap::DEFAULT_PLY_LIMIT), reportCallback(NULL) {
+    bucketCount = std::max(tableSize / WAYS, (uint64_t) 1);
+    table = new Entry[bucketCount * WAYS];
+    resetTable();
+}
+
+DfPn::~DfPn() {
+    delete[] table;
+}
+
+void DfPn::resetTable() {
+    memset(table, 0, bucketCount * WAYS * sizeof (Entry));
+}
+
+/**
+ * The position and its mirror image share an entry. The position only tells the
+ * player to move apart from the other player, so the colour to move is added or
+ * OR and AND nodes could meet after white popped before the root.
+ */
+bitboard DfPn::getKey(bitboard pos, bool whiteMoves) const {
+    return std::min(pos, flip(pos)) << 1 | (whiteMoves ? 1 : 0);
+}
+
+bool DfPn::lookup(bitboard key, uint32_t& proof, uint32_t& disproof) {
+    Entry* bucket = &table[key % bucketCount * WAYS];
+    for (int i = 0; i < WAYS; i++) {
+        if (bucket[i].key == key) {
+            tableHits++;
+            proof = bucket[i].proof;
+            disproof = bucket[i].disproof;
+            return true;
+        }
+    }
+    return false;
+}
+
+void DfPn::store(bitboard key, uint32_t proof, uint32_t disproof, uint32_t work) {
+    Entry* bucket = &table[key % bucketCount * WAYS];
+    Entry* slot = &bucket[0];
+    for (int i = 0; i < WAYS; i++) {
+        if (bucket[i].key == key) {
+            slot = &bucket[i];
+            break;
+        }
+        if (bucket[i].work < slot->work) slot = &bucket[i];
+    }
+    if (slot->key != key && slot->key != 0) replacements++;
+    slot->key = key;
+    slot->proof = proof;
+    slot->disproof = disproof;
+    slot->work = work;
+}
+
+/**
+ * The same as Proof::evaluateChildWithHandicap
+ */
+int DfPn::evaluateChild(const Successor& s) const {
+    bool whiteMoves = ply % 2 == 0;
+
+    if (hasWon(s.newOther)) {
+        return whiteMoves ? PROVEN : DISPROVEN;
+    }
+    if (s.pop) {
+        if (hasWon(s.newCurrent)) {
+            return whiteMoves ? DISPROVEN : PROVEN;
+        }
+        if (whiteMoves) return DISPROVEN;
+    }
+    if (ply >= handicapPlyLimit) return DISPROVEN;
+    return UNKNOWN;
+}
+
+int DfPn::solve() {
+    bool whiteMoves = ply % 2 == 0;
+    if (hasWon(other)) {
+        return LOSS;
+    }
+    if (hasWon(current)) {
+        return WIN;
+    }
+
+    expansions = tableHits = replacements = 0;
+    resetTable();
+    uint32_t proof, disproof;
+    search(INF, INF, proof, disproof);
+
+    if (proof == 0) {
+        return whiteMoves ? WIN : LOSS;
+    }
+    if (disproof == 0) {
+        return whiteMoves ? DRAW_OR_LOSS : DRAW_OR_WIN;
+    }
+    return UNKNOWN;
+}
+
+/**
+ * Searches the current position until its proof number reaches proofThreshold or
+ * its disproof number reaches disproofThreshold. White's nodes are OR nodes and
+ * red's are AND nodes. Returns the number of nodes searched.
+ */
+uint32_t DfPn::search(uint32_t proofThreshold, uint32_t disproofThreshold, uint32_t& proof, uint32_t& disproof) {
+    expansions++;
+    if (reportCallback != NULL && expansions % 100000 == 0) {
+        reportCallback();
+    }
+
+    bool orNode = ply % 2 == 0;
+    bitboard key = getKey(getPosition(), orNode);
+
+    Successor succ[WIDTH * 2];
+    int count = getSuccessors(succ, false);
+    uint32_t proofs[WIDTH * 2 + 1];
+    uint32_t disproofs[WIDTH * 2 + 1];
+    char moves[WIDTH * 2 + 1];
+
+    for (int i = 0; i < count; i++) {
+        Successor& s = succ[i];
+        moves[i] = s.pop ? 'A' + s.column : 'a' + s.column;
+        switch (evaluateChild(s)) {
+            case PROVEN:
+                proofs[i] = 0;
+                disproofs[i] = INF;
+                break;
+            case DISPROVEN:
+                proofs[i] = INF;
+                disproofs[i] = 0;
+                break;
+            default:
+            {
+                bitboard pos = Connect4::getPosition(s.newCurrent, s.newOther);
+                if (!lookup(getKey(pos, !orNode), proofs[i], disproofs[i])) {
+                    proofs[i] = disproofs[i] = 1;
+                }
+            }
+        }
+    }
+    //on a full board the player to move may take the draw
+    if ((current | other) == FULL) {
+        proofs[count] = INF;
+        disproofs[count] = 0;
+        moves[count] = '.';
+        count++;
+    }
+
+    uint64_t work = 1;
+    while (true) {
+        //the numbers that are minimized and summed at this node
+        uint32_t* mins = orNode ? proofs : disproofs;
+        uint32_t* sums = orNode ? disproofs : proofs;
+        uint32_t minimum = INF;
+        uint32_t sum = 0;
+        int best = -1;
+        uint32_t second = INF;
+        for (int i = 0; i < count; i++) {
+            sum = std::min(sum + sums[i], INF);
+            if (mins[i] < minimum) {
+                second = minimum;
+                minimum = mins[i];
+                best = i;
+            } else if (mins[i] < second) {
+                second = mins[i];
+            }
+        }
+        proof = orNode ? minimum : sum;
+        disproof = orNode ? sum : minimum;
+
+        if (proof >= proofThreshold || disproof >= disproofThreshold) break;
+        if (proof == 0 || disproof == 0) break;
+        assert(best >= 0 && moves[best] != '.');
+
+        //the child is searched until it is clearly no longer the best or the parent's threshold is reached,
+        //the margin over the second best keeps it from being reentered after every step when the table is small
+        uint32_t minThreshold = std::min(orNode ? proofThreshold : disproofThreshold, std::min(second + second / 4 + 1, INF));
+        uint32_t sumThreshold = std::min((orNode ? disproofThreshold : proofThreshold) - sum + sums[best], INF);
+        play(moves[best]);
+        if (orNode) {
+            work += search(minThreshold, sumThreshold, proofs[best], disproofs[best]);
+        } else {
+            work += search(sumThreshold, minThreshold, proofs[best], disproofs[best]);
+        }
+        undo();
+    }
+
+    work = std::min(work, (uint64_t) UINT32_MAX);
+    store(key, proof, disproof, work);
+    return work;
+}
@@ -0,0 +1,70 @@
+#ifndef DFPN_H
+#define	DFPN_H
+
+#include <functional>
+#include "game.h"
+#include "handicap.h"
+
+/**
+ * Depth-first proof-number search. Like Proof it tries to prove that white wins
+ * under the handicap, but instead of keeping the tree in memory it searches depth
+ * first and keeps the proof and disproof numbers in a transposition table. A node
+ * is searched until its numbers reach the thresholds given by its parent, which
+ * are set so that the parent returns as soon as another child becomes the most
+ * proving one. The table has a fixed size, so memory use is bounded, and the
+ * numbers of a position are reused wherever the position is reached.
+ *
+ * White cannot pop under the handicap, so the number of white pieces grows with
+ * every white move and a position cannot repeat. The ply of a position is then
+ * the same on every path from the root, and so is the effect of the ply limit.
+ */
+class DfPn : public Game {
+public:
+    static const uint64_t DEFAULT_TABLE_SIZE = 1 << 22;
+
+private:
+    static const uint32_t INF = 100000000;
+    static const int WAYS = 2;
+
+    typedef struct {
+        bitboard key;
+        uint32_t proof;
+        uint32_t disproof;
+        //nodes searched under the position, replaced entries are the ones with the least work
+        uint32_t work;
+    } Entry;
+
+    Entry* table;
+    uint64_t bucketCount;
+
+    bool lookup(bitboard key, uint32_t& proof, uint32_t& disproof);
+    void store(bitboard key, uint32_t proof, uint32_t disproof, uint32_t work);
+
+    bitboard getKey(bitboard pos, bool whiteMoves) const;
+    int evaluateChild(const Successor& s) const;
+    uint32_t search(uint32_t proofThreshold, uint32_t disproofThreshold, uint32_t& proof, uint32_t& disproof);
+
+public:
+    int handicapPlyLimit;
+    std::function<void() > reportCallback;
+
+    uint64_t expansions;
+    uint64_t tableHits;
+    uint64_t replacements;
+
+    DfPn(uint64_t tableSize = DEFAULT_TABLE_SIZE);
+    ~DfPn();
+
+    /**
+     * Returns WIN or LOSS if white wins, otherwise DRAW_OR_LOSS or DRAW_OR_WIN
+     * from the perspective of the player to move
+     */
+    int solve();
+    void resetTable();
+
+    uint64_t getTableSize() const {
+        return bucketCount * WAYS;
+    }
+};
+
+#endif
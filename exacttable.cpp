@@ -0,0 +1,66 @@
+#include "exacttable.h"
+#include <cassert>
+
+using namespace Connect4;
+
+ExactTable::ExactTable(uint64_t s, uint64_t work) : table(NULL), size(0), minWork(work) {
+    int bits = 0;
+    while (bits < POSITION_BITS && ((uint64_t) 2 << bits) <= s) {
+        bits++;
+    }
+    if (s > 0) {
+        size = (uint64_t) 1 << bits;
+        table = new std::atomic<uint64_t>[size];
+    }
+    indexShift = POSITION_BITS - bits;
+    reset();
+}
+
+ExactTable::~ExactTable() {
+    delete[] table;
+}
+
+/**
+ * Must not be called while other threads are using the table
+ */
+void ExactTable::reset() {
+    for (uint64_t i = 0; i < size; i++) {
+        table[i].store(0, std::memory_order_relaxed);
+    }
+    stored = 0;
+    dropped = 0;
+}
+
+void ExactTable::store(bitboard pos, int score, uint64_t work) {
+    assert(score == WIN || score == DRAW || score == LOSS);
+    if (size == 0 || work < minWork) return;
+
+    //LOSS, DRAW and WIN become 1, 2 and 3 so that an empty slot is 0
+    uint64_t whole = (pos << 2) | ((score + 1) / 2);
+    uint64_t index = getIndex(pos);
+    for (int i = 0; i < MAX_PROBES; i++) {
+        std::atomic<uint64_t>& slot = table[(index + i) & (size - 1)];
+        uint64_t e = slot.load(std::memory_order_relaxed);
+        if (e == 0) {
+            if (slot.compare_exchange_strong(e, whole, std::memory_order_relaxed)) {
+                stored.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        //either the slot was taken or another thread just took it
+        if ((e >> 2) == pos) return;
+    }
+    dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+int ExactTable::fetch(bitboard pos) const {
+    if (size == 0) return UNKNOWN;
+
+    uint64_t index = getIndex(pos);
+    for (int i = 0; i < MAX_PROBES; i++) {
+        uint64_t e = table[(index + i) & (size - 1)].load(std::memory_order_relaxed);
+        if (e == 0) return UNKNOWN;
+        if ((e >> 2) == pos) return (e & 3) * 2 - 1;
+    }
+    return UNKNOWN;
+}
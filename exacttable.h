@@ -0,0 +1,58 @@
+#ifndef EXACT_TABLE_H
+#define EXACT_TABLE_H
+
+#include <atomic>
+#include "connect4.h"
+
+/**
+ * Keeps proven WIN, DRAW and LOSS scores that would otherwise compete with
+ * inexact bounds for the slots of the transposition table. Entries are never
+ * replaced: once the table is full, new results are simply not stored.
+ *
+ * Each entry is the position itself with the score packed in the two lowest bits,
+ * so no collisions are possible. The table uses linear probing and threads can
+ * share it without locking.
+ */
+class ExactTable {
+public:
+    //cheaper proofs are not worth a permanent slot
+    static const uint64_t DEFAULT_MIN_WORK = 1000;
+
+private:
+    static const int POSITION_BITS = BOARD_WIDTH * (BOARD_HEIGHT + 1);
+    static const uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+    static const int MAX_PROBES = 32;
+
+    std::atomic<uint64_t>* table;
+    uint64_t size;
+    int indexShift;
+    uint64_t minWork;
+
+    std::atomic<uint64_t> stored;
+    std::atomic<uint64_t> dropped;
+
+    uint64_t getIndex(bitboard pos) const {
+        return (((pos * HASH_MULTIPLIER) & (((uint64_t) 1 << POSITION_BITS) - 1)) >> indexShift);
+    }
+
+public:
+    /**
+     * The size is rounded down to a power of two
+     */
+    ExactTable(uint64_t size, uint64_t minWork = DEFAULT_MIN_WORK);
+    ~ExactTable();
+    void reset();
+    void store(bitboard pos, int score, uint64_t work);
+    int fetch(bitboard pos) const;
+
+    uint64_t getStored() const {
+        return stored.load(std::memory_order_relaxed);
+    }
+
+    //results that did not fit
+    uint64_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
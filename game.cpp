@@ -90,6 +90,16 @@ void Game::setPosition(bitboard pos) {
 
 }
 
+void Game::setBoard(bitboard newCurrent, bitboard newOther, int newPly) {
+    current = newCurrent;
+    other = newOther;
+    ply = newPly;
+    bitboard occupied = current | other;
+    for (int i = 0; i < WIDTH; i++) {
+        heights[i] = i * Connect4::H1 + Connect4::countBits(occupied & columnMasks[i]);
+    }
+}
+
 bool Game::hasEnded() {
     return Connect4::hasWon(current) || Connect4::hasWon(other);
 }
@@ -32,6 +32,12 @@ protected:
     void resizePast(int);
     int getSuccessors(Successor(&succ)[WIDTH * 2], bool removeSymmetric = false);
 
+    /**
+     * Puts a position reached by a search on the board without playing the moves
+     * to it. The past positions and moves are left as they are.
+     */
+    void setBoard(bitboard newCurrent, bitboard newOther, int newPly);
+
 public:
     Game();
     ~Game();
@@ -102,13 +102,25 @@ void MainWindow::createMenus() {
     QSignalMapper *mapper = new QSignalMapper(this);
     connect(mapper, SIGNAL(mapped(int)), searchWidget, SLOT(changeTransSize(int)));
     transMenu->addAction(createTransAction(group, mapper, 0));
-    transMenu->addAction(createTransAction(group, mapper, 8388593));
-    transMenu->addAction(createTransAction(group, mapper, 15999961));
-    transMenu->addAction(createTransAction(group, mapper, 33554393));
-    transMenu->addAction(createTransAction(group, mapper, 67108859));
-    //transMenu->addAction(createTransAction(group, mapper, 100663243));
-    transMenu->addAction(createTransAction(group, mapper, 134217689));
-    transMenu->addAction(createTransAction(group, mapper, 268435399));
+    //the sizes are numbers of entries and must be powers of two
+    for (int bits = 24; bits <= 29; bits++) {
+        transMenu->addAction(createTransAction(group, mapper, 1 << bits));
+    }
+
+    //threads used for solving the columns in column mode
+    QMenu* threadMenu = settingsMenu->addMenu("Column mode threads");
+    QActionGroup *threadGroup = new QActionGroup(this);
+    QSignalMapper *threadMapper = new QSignalMapper(this);
+    connect(threadMapper, SIGNAL(mapped(int)), searchWidget, SLOT(changeThreadCount(int)));
+    for (int count = 1; count <= 32; count *= 2) {
+        QAction* act = new QAction(QString::number(count), this);
+        act->setCheckable(true);
+        act->setChecked(count == 1);
+        act->setActionGroup(threadGroup);
+        threadMapper->setMapping(act, count);
+        connect(act, SIGNAL(triggered()), threadMapper, SLOT(map()));
+        threadMenu->addAction(act);
+    }
 }
 
 QAction* MainWindow::createTransAction(QActionGroup* group, QSignalMapper* mapper, int size) {
@@ -116,7 +128,7 @@ QAction* MainWindow::createTransAction(QActionGroup* group, QSignalMapper* mappe
     const int GIGA = 1024 * 1024 * 1024;
     const int MEGA = 1024 * 1024;
 
-    qint64 bytes = (qint64) size * 16;
+    qint64 bytes = (qint64) size * sizeof (entry);
 
     if (bytes == 0) {
         title = "Disabled";
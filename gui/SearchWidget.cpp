@@ -82,6 +82,13 @@ void SearchWidget::changeTransSize(int size) {
     }
 }
 
+void SearchWidget::changeThreadCount(int count) {
+    if (isLocked()) {
+        return;
+    }
+    worker->setThreadCount(count);
+}
+
 void SearchWidget::doAlphaBeta() {
     if (isLocked()) return;
 
@@ -32,6 +32,7 @@ public:
 
 public slots:
     void changeTransSize(int);
+    void changeThreadCount(int);
     void copyAll();
     void setResults(QString text);
     void setText(QString text);
@@ -1,20 +1,52 @@
 #include <iostream>
 #include <sstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include "SearchWorker.h"
 #include "connect4.h"
 #include "minimax.h"
 #include "full.h"
 #include <functional>
+#include <stdexcept>
 
-SearchWorker::SearchWorker() : transTable(NULL), retro(NULL), proof(NULL) {
+const char* const SearchWorker::DEFAULT_RETRO_DB = "retro.db";
+
+SearchWorker::SearchWorker() : transTable(NULL), exactTable(NULL), retroDb(NULL), proof(NULL), threadCount(1) {
     alphaBeta = new AlphaBeta();
     handicap = new Handicap();
+
+    //a database saved by an earlier retrograde analysis is probed by the searches
+    openRetroDb();
+}
+
+/**
+ * Opens the database of an earlier retrograde analysis for the searches, if there
+ * is one. The searches only probe it up to its piece limit, and the retrograde
+ * request only uses a database that covers the whole board.
+ */
+void SearchWorker::openRetroDb() {
+    try {
+        retroDb = new RetroDb(DEFAULT_RETRO_DB);
+    } catch (const std::runtime_error&) {
+    }
+    if (retroDb != NULL && !isRetroDbComplete()) {
+        std::cerr << DEFAULT_RETRO_DB << " has the positions with up to " << retroDb->getMaxPieces()
+                << " pieces, the retrograde analysis will build it again" << std::endl;
+    }
+    alphaBeta->setEndgameDb(retroDb);
+    handicap->setEndgameDb(retroDb);
+}
+
+bool SearchWorker::isRetroDbComplete() const {
+    return retroDb != NULL && retroDb->getMaxPieces() >= Connect4::WIDTH * Connect4::HEIGHT;
 }
 
 SearchWorker::~SearchWorker() {
     delete transTable;
-    delete retro;
+    delete exactTable;
+    delete retroDb;
     delete alphaBeta;
     delete handicap;
     delete proof;
@@ -25,6 +57,12 @@ void SearchWorker::setTransTableSize(int size) {
     transTable = new TransTable(size);
     alphaBeta->setTransTable(transTable);
     handicap->setTransTable(transTable);
+
+    if (exactTable == NULL) {
+        exactTable = new ExactTable(DEFAULT_EXACT_SIZE);
+        alphaBeta->setExactTable(exactTable);
+        handicap->setExactTable(exactTable);
+    }
 }
 
 void SearchWorker::setPlyLimit(int limit) {
@@ -90,10 +128,29 @@ void SearchWorker::handicapReport() {
 
 void SearchWorker::proofNumberReport() {
     QLocale locale(QLocale::English);
-    QString str = "Expanded: %1\n\nAllocated: %2\nMemory: %3 MB";
+    const NodeArena& arena = proof->getArena();
+    QString str = "Expanded: %1\n\nAllocated: %2\nMemory: %3 MB\n\nArena: %4 MB in %5 slabs\nFree listed: %6\nAllocations: %7";
     str = str.arg(locale.toString(proof->expansions));
     str = str.arg(locale.toString(proof->allocated));
-    str = str.arg(locale.toString((qulonglong) proof->allocated * sizeof (Node) / 1024));
+    str = str.arg(locale.toString((qulonglong) proof->allocated * sizeof (Node) / (1024 * 1024)));
+    str = str.arg(locale.toString((qulonglong) arena.getReservedBytes() / (1024 * 1024)));
+    str = str.arg(arena.getSlabCount());
+    str = str.arg(locale.toString((qulonglong) arena.getFreeNodes()));
+    str = str.arg(locale.toString((qulonglong) arena.getAllocations()));
+
+    emit update(str);
+}
+
+void SearchWorker::columnsReport(const std::vector<uint64_t>& nodes, int solved, int total) {
+    QLocale locale(QLocale::English);
+    qulonglong sum = 0;
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        sum += nodes[i];
+    }
+    QString str = "Solved: %1 of %2 moves\n\nNodes: %3\nThreads: %4";
+    str = str.arg(solved).arg(total);
+    str = str.arg(locale.toString(sum));
+    str = str.arg(nodes.size());
 
     emit update(str);
 }
@@ -116,11 +173,23 @@ int SearchWorker::getResult(const SearchRequest& request, const Game& game) {
             r = handicap->search();
             break;
         case RetrogradeRequest:
-            if (retro == NULL) {
+            if (retroDb == NULL) openRetroDb();
+            //a database saved with a piece limit does not know the positions above it
+            if (!isRetroDbComplete()) {
+                //the file is mapped, so it is closed before it is written again
+                alphaBeta->setEndgameDb(NULL);
+                handicap->setEndgameDb(NULL);
+                delete retroDb;
+                retroDb = NULL;
                 emit update("Performing retrograde analysis...");
-                retro = new Retro;
+                Retro retro;
+                retro.save(DEFAULT_RETRO_DB);
+                openRetroDb();
+                if (retroDb == NULL) {
+                    throw std::runtime_error(std::string("Cannot open ") + DEFAULT_RETRO_DB);
+                }
             }
-            r = retro->getScore(game.getPosition());
+            r = retroDb->getScore(game.getPosition());
             if (r == UNKNOWN) r = DRAW_BY_REPEAT;
             break;
         case ProofNumberRequest:
@@ -140,6 +209,112 @@ int SearchWorker::getResult(const SearchRequest& request, const Game& game) {
     return r;
 }
 
+/**
+ * Adds the score of a root move to the total and returns the score for its lamp
+ */
+int addColumnResult(int r, int& bestScore, bool& hasUnknown) {
+    using namespace Connect4;
+
+    if (r == UNKNOWN) {
+        hasUnknown = true;
+    } else if (r == DRAW_BY_REPEAT) {
+        bestScore = std::max(bestScore, DRAW);
+    } else {
+        r = SCORE_CEILING - r;
+        bestScore = std::max(bestScore, r);
+    }
+    return r;
+}
+
+/**
+ * Solves the root moves on a pool of threads, each with its own engine. The threads
+ * share the transposition table and every lamp is updated as soon as its move is solved.
+ */
+void SearchWorker::solveColumnsInParallel(const SearchRequest& request, const Game& game, int& bestScore, bool& hasUnknown) {
+    if (transTable == NULL) setTransTableSize(DEFAULT_TT_SIZE);
+    //the table is cleared once for all moves so that they can reuse each other's work
+    transTable->reset();
+
+    std::vector<std::string> variations;
+    std::vector<int> lamps;
+    Game child;
+    child.setVariation(game.getVariation());
+    for (int i = 0; i < BOARD_WIDTH; i++) {
+        if (child.drop(i)) {
+            variations.push_back(child.getVariation());
+            lamps.push_back(i);
+            child.undrop(i);
+        }
+    }
+    for (int i = 0; i < BOARD_WIDTH; i++) {
+        if (child.pop(i)) {
+            variations.push_back(child.getVariation());
+            lamps.push_back(i + BOARD_WIDTH);
+            child.unpop(i);
+        }
+    }
+
+    std::atomic<int> next(0);
+    std::atomic<bool> outOfMemory(false);
+    std::mutex resultLock;
+    int plyLimit = handicap->plyLimit;
+    int count = std::min(threadCount, (int) variations.size());
+    //the nodes of each thread and the moves solved, under resultLock
+    std::vector<uint64_t> nodes(count, 0);
+    int solved = 0;
+
+    auto solve = [&](int id) {
+        Minimax* engine = NULL;
+        try {
+            if (request.type == AlphaBetaRequest) {
+                engine = new AlphaBeta();
+            } else {
+                Handicap* h = new Handicap();
+                h->plyLimit = plyLimit;
+                engine = h;
+            }
+            engine->setTransTable(transTable);
+            engine->setExactTable(exactTable);
+            engine->setEndgameDb(retroDb);
+            //the nodes of the moves this thread has solved
+            uint64_t done = 0;
+            engine->reportCallback = [&, engine, id]() {
+                std::lock_guard<std::mutex> guard(resultLock);
+                nodes[id] = done + engine->interiorCount;
+                columnsReport(nodes, solved, variations.size());
+            };
+
+            int i;
+            while ((i = next++) < (int) variations.size() && !outOfMemory) {
+                engine->setVariation(variations[i]);
+                int r = engine->search(request.type == AlphaBetaRequest ? request.maxDepth : 0, true, false);
+                {
+                    std::lock_guard<std::mutex> guard(resultLock);
+                    r = addColumnResult(r, bestScore, hasUnknown);
+                    done += engine->interiorCount;
+                    nodes[id] = done;
+                    solved++;
+                    columnsReport(nodes, solved, variations.size());
+                }
+                emit updateLamp(lamps[i], r);
+            }
+        } catch (const std::bad_alloc&) {
+            outOfMemory = true;
+        }
+        delete engine;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < count; i++) {
+        threads.push_back(std::thread(solve, i));
+    }
+    for (int i = 0; i < count; i++) {
+        threads[i].join();
+    }
+
+    if (outOfMemory) throw std::bad_alloc();
+}
+
 void SearchWorker::processColumns(SearchRequest request) {
     using namespace Connect4;
 
@@ -158,40 +333,23 @@ void SearchWorker::processColumns(SearchRequest request) {
     bool hasUnknown = false;
 
     try {
-        for (int i = 0; i < BOARD_WIDTH; i++) {
-            if (game.drop(i)) {
-                int r = getResult(request, game);
-
-                if (r == UNKNOWN) {
-                    hasUnknown = true;
-                } else if (r == DRAW_BY_REPEAT) {
-                    bestScore = std::max(bestScore, DRAW);
-                } else {
-                    r = SCORE_CEILING - r;
-                    bestScore = std::max(bestScore, r);
+        if (threadCount > 1 && (request.type == AlphaBetaRequest || request.type == HandicapRequest)) {
+            solveColumnsInParallel(request, game, bestScore, hasUnknown);
+        } else {
+            for (int i = 0; i < BOARD_WIDTH; i++) {
+                if (game.drop(i)) {
+                    int r = addColumnResult(getResult(request, game), bestScore, hasUnknown);
+                    emit updateLamp(i, r);
+                    game.undrop(i);
                 }
-
-                emit updateLamp(i, r);
-                game.undrop(i);
             }
-        }
 
-        for (int i = 0; i < BOARD_WIDTH; i++) {
-            if (game.pop(i)) {
-                int r = getResult(request, game);
-
-                if (r == UNKNOWN) {
-                    hasUnknown = true;
-                } else if (r == DRAW_BY_REPEAT) {
-                    bestScore = std::max(bestScore, DRAW);
-                } else {
-                    r = SCORE_CEILING - r;
-                    bestScore = std::max(bestScore, r);
+            for (int i = 0; i < BOARD_WIDTH; i++) {
+                if (game.pop(i)) {
+                    int r = addColumnResult(getResult(request, game), bestScore, hasUnknown);
+                    emit updateLamp(i + BOARD_WIDTH, r);
+                    game.unpop(i);
                 }
-
-                emit updateLamp(i + BOARD_WIDTH, r);
-                game.unpop(i);
-
             }
         }
     } catch (const std::bad_alloc&) {
@@ -240,10 +398,10 @@ void SearchWorker::processSingle(SearchRequest request) {
             minimax = handicap;
         }
 
-        QString str = "Interior: %1\nTerminal: %2\nReused (exact): %3\nReused (inexact): %4\nTainted: %5\nDepth cutoffs: %6\n\nTime elapsed: <b><font color=red>%7 s</font></b>\nSpeed: %8 nodes/sec";
+        QString str = "Interior: %1\nTerminal: %2\nReused (exact): %3\nReused (inexact): %4\nTainted: %5\nDepth cutoffs: %6\nEndgame hits: %7\n\nTime elapsed: <b><font color=red>%8 s</font></b>\nSpeed: %9 nodes/sec";
         str = str.arg(minimax->interiorCount).arg(minimax->terminalCount);
         str = str.arg(minimax->reusedCount).arg(minimax->inexactReusedCount).arg(minimax->taintedCount);
-        str = str.arg(minimax->depthCutoffs);
+        str = str.arg(minimax->depthCutoffs).arg(minimax->endgameHits);
         str = str.arg(minimax->elapsedSeconds);
         qint64 totalNodes = minimax->interiorCount + minimax->terminalCount;
         str = str.arg(QString::number(totalNodes / (double) minimax->elapsedSeconds, 'f', 0));
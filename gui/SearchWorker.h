@@ -3,6 +3,7 @@
 
 #include <QtWidgets>
 #include "retro.h"
+#include "retrodb.h"
 #include "minimax.h"
 #include "alphabeta.h"
 #include "handicap.h"
@@ -14,14 +15,21 @@
 class SearchWorker : public QObject {
     Q_OBJECT
     TransTable *transTable;
+    //proven scores are kept between searches
+    ExactTable *exactTable;
     AlphaBeta* alphaBeta;
     Handicap* handicap;
-    Retro* retro;
+    //the retrograde results, saved to a file so they are built only once
+    RetroDb* retroDb;
     Proof* proof;
+    //number of threads used to solve the root moves in column mode
+    int threadCount;
     
 public:
 
-    static const int DEFAULT_TT_SIZE = 67108859;
+    static const int DEFAULT_TT_SIZE = 1 << 27;
+    static const int DEFAULT_EXACT_SIZE = 1 << 23;
+    static const char* const DEFAULT_RETRO_DB;
 
     enum RequestType {
         AlphaBetaRequest, HandicapRequest, RetrogradeRequest, ProofNumberRequest, ExactProofNumberRequest
@@ -42,6 +50,10 @@ public:
     int getPlyLimit();
     void setPlyLimit(int limit);
 
+    void setThreadCount(int count) {
+        threadCount = count;
+    }
+
 public slots:
     void processColumns(SearchRequest);
     void processSingle(SearchRequest);
@@ -54,10 +66,14 @@ signals:
     void computerMove(char ch);
 
 private:
+    void openRetroDb();
+    bool isRetroDbComplete() const;
     int getResult(const SearchRequest& type, const Game& game);
+    void solveColumnsInParallel(const SearchRequest& request, const Game& game, int& bestScore, bool& hasUnknown);
     void alphaBetaReport();
     void handicapReport();
     void proofNumberReport();
+    void columnsReport(const std::vector<uint64_t>& nodes, int solved, int total);
 };
 
 #endif
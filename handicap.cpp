@@ -54,7 +54,8 @@ int Handicap::prove() {
         reportCallback();
     }
 
-    if (ply >= plyLimit) {
+    //an abandoned search is treated like reaching the ply limit
+    if (ply >= plyLimit || isStopped()) {
         depthCutoffs++;
         return whiteMoves ? LOSS | TAINTED : WIN | TAINTED;
     }
@@ -69,8 +70,8 @@ int Handicap::prove() {
     uint64_t startNodes = interiorCount;
     bitboard currentPosition = pastPositions[ply] = getPosition();
 
-#if SYMMETRY_ON
     bool symmetric = false;
+#if SYMMETRY_ON
     bitboard mirror = flip(currentPosition);
     if (mirror == currentPosition) {
         symmetric = true;
@@ -87,6 +88,15 @@ int Handicap::prove() {
     //use transScore only if white hasn't made pop moves due to GHI problem
     if (popCount == 0) {
         transScore = trans->fetch(currentPosition);
+
+        if (transScore == UNKNOWN && exact != NULL) {
+            int exactScore = exact->fetch(currentPosition);
+            //only the question whether white wins matters here
+            if (exactScore != UNKNOWN) {
+                bool whiteWins = exactScore == (whiteMoves ? WIN : LOSS);
+                transScore = whiteWins == whiteMoves ? WIN : LOSS;
+            }
+        }
     }
     if (transScore != UNKNOWN) {
         reusedCount++;
@@ -94,6 +104,13 @@ int Handicap::prove() {
     }
 #endif
 
+    //the database has real results, so white's wins hold and so do the other results
+    int endgameScore = probeEndgame();
+    if (endgameScore != UNKNOWN) {
+        bool whiteWins = endgameScore == (whiteMoves ? WIN : LOSS);
+        return whiteWins == whiteMoves ? WIN : LOSS;
+    }
+
     //Step 1: Generate successors
     Successor succ[WIDTH * 2];
     int moveCount = getSuccessors(succ);
@@ -142,29 +159,7 @@ int Handicap::prove() {
         }
 #endif
 
-        current = succ[i].newCurrent;
-        other = succ[i].newOther;
-
-        if (succ[i].pop) {
-            if (whiteMoves) popCount++;
-            heights[move]--;
-            pastMoves[ply - 1] = 'A' + move;
-        } else {
-            heights[move]++;
-            pastMoves[ply - 1] = 'a' + move;
-        }
-
-        score = prove();
-
-        if (succ[i].pop) {
-            if (whiteMoves) popCount--;
-            heights[move]++;
-            pastMoves[ply - 1] = 0;
-        } else {
-            heights[move]--;
-            pastMoves[ply - 1] = 0;
-        }
-
+        score = proveReply(succ[i], whiteMoves);
         assert(score != UNKNOWN);
 
         if ((score & TAINTED) != 0) {
@@ -187,6 +182,20 @@ int Handicap::prove() {
         } else {
             assert(score == LOSS);
         }
+
+        if (splitting && !whiteMoves) {
+            int rest = splitReplies(succ, i + 1, moveCount, symmetric);
+            if (rest != UNKNOWN) {
+                bool restTainted = (rest & TAINTED) != 0;
+                if ((rest & ~TAINTED) == WIN) {
+                    bestTainted = restTainted;
+                    bestScore = WIN;
+                } else {
+                    bestTainted |= restTainted;
+                }
+                break;
+            }
+        }
     }
     ply--;
     current = oldCurrent;
@@ -200,7 +209,43 @@ int Handicap::prove() {
 #if TRANS_ON
     trans->store(currentPosition, bestScore, interiorCount - startNodes);
     //assert(trans->fetch(currentPosition) == bestScore);
+
+    //white's wins are real wins because red was not restricted, the other results only hold under the handicap
+    if (bestScore == (whiteMoves ? WIN : LOSS) && exact != NULL) {
+        exact->store(currentPosition, bestScore, interiorCount - startNodes);
+    }
 #endif
 
     return bestScore;
 }
+
+/**
+ * Makes the move of the given successor on a node whose ply has already been
+ * advanced, proves the resulting position and takes the move back
+ */
+int Handicap::proveReply(Successor& s, bool whiteMoves) {
+    int move = s.column;
+    current = s.newCurrent;
+    other = s.newOther;
+
+    if (s.pop) {
+        if (whiteMoves) popCount++;
+        heights[move]--;
+        pastMoves[ply - 1] = 'A' + move;
+    } else {
+        heights[move]++;
+        pastMoves[ply - 1] = 'a' + move;
+    }
+
+    int score = prove();
+
+    if (s.pop) {
+        if (whiteMoves) popCount--;
+        heights[move]++;
+        pastMoves[ply - 1] = 0;
+    } else {
+        heights[move]--;
+        pastMoves[ply - 1] = 0;
+    }
+    return score;
+}
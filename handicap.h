@@ -15,14 +15,27 @@ public:
     int plyLimit;
     static const int reportInterval = 200000;
 
-    Handicap() : plyLimit(DEFAULT_PLY_LIMIT) {
+    Handicap() : plyLimit(DEFAULT_PLY_LIMIT), splitting(false) {
     };
 
 protected:
+    //set by parallel provers that want splitReplies to be called
+    bool splitting;
+
     int execute(int depth);
+    int prove();
+    int proveReply(Successor& s, bool whiteMoves);
+
+    /**
+     * Called on red nodes once a reply has been refuted (young brothers wait). The
+     * remaining replies are succ[first..moveCount). Returns UNKNOWN if they should be
+     * searched serially, otherwise their combined score from red's perspective.
+     */
+    virtual int splitReplies(Successor(&)[WIDTH * 2], int, int, bool) {
+        return Connect4::UNKNOWN;
+    }
 
 private:
-    int prove();
     int fastEvaluate(Successor(&succ)[WIDTH * 2], int moveCount);
 
 };
@@ -0,0 +1,95 @@
+#include "lazysmp.h"
+#include <chrono>
+#include <thread>
+
+using namespace Connect4;
+
+LazySmp::LazySmp(int threadCount, std::function<Minimax*() > factory) : trans(NULL) {
+    if (threadCount < 1) threadCount = 1;
+    for (int i = 0; i < threadCount; i++) {
+        Minimax* engine = factory();
+        engine->setStopFlag(&stopped);
+        engines.push_back(engine);
+    }
+    stopped = false;
+}
+
+LazySmp::~LazySmp() {
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        delete engines[i];
+    }
+}
+
+void LazySmp::setTransTable(TransTable* tt) {
+    trans = tt;
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        engines[i]->setTransTable(tt);
+    }
+}
+
+void LazySmp::setExactTable(ExactTable* et) {
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        engines[i]->setExactTable(et);
+    }
+}
+
+void LazySmp::setEndgameDb(const RetroDb* db, int maxPieces) {
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        engines[i]->setEndgameDb(db, maxPieces);
+    }
+}
+
+void LazySmp::setVariation(const std::string& variation) {
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        engines[i]->setVariation(variation);
+    }
+}
+
+void LazySmp::run(int id, int depth, int* result) {
+    Minimax* engine = engines[id];
+    engine->perturbHistory(id);
+    //the table is cleared once by the driver, not by every thread
+    int v = engine->search(depth, false, false);
+
+    if (!stopped.exchange(true)) {
+        *result = v;
+    }
+}
+
+int LazySmp::search(int depth, bool newTable) {
+#if TRANS_ON
+    if (newTable) {
+        trans->reset();
+    } else {
+        trans->nextGeneration();
+    }
+#endif
+    stopped = false;
+    int result = UNKNOWN;
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 1; i < engines.size(); i++) {
+        helpers.push_back(std::thread(&LazySmp::run, this, i, depth, &result));
+    }
+    run(0, depth, &result);
+    for (unsigned int i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    elapsedSeconds = std::chrono::duration<double>(end - begin).count();
+
+    interiorCount = reusedCount = inexactReusedCount = taintedCount = terminalCount = depthCutoffs = endgameHits = 0;
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        Minimax* engine = engines[i];
+        interiorCount += engine->interiorCount;
+        reusedCount += engine->reusedCount;
+        inexactReusedCount += engine->inexactReusedCount;
+        taintedCount += engine->taintedCount;
+        terminalCount += engine->terminalCount;
+        depthCutoffs += engine->depthCutoffs;
+        endgameHits += engine->endgameHits;
+    }
+
+    return result;
+}
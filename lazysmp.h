@@ -0,0 +1,54 @@
+#ifndef LAZYSMP_H
+#define	LAZYSMP_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "minimax.h"
+
+/**
+ * Lazy SMP: every thread searches the same root with its own engine and they all
+ * share one transposition table. The helper threads use perturbed move ordering so
+ * that they drift into different subtrees and fill the table for each other.
+ * The first thread to finish stops the rest and its score is returned.
+ */
+class LazySmp {
+    std::vector<Minimax*> engines;
+    std::atomic<bool> stopped;
+    TransTable* trans;
+
+    void run(int id, int depth, int* result);
+
+public:
+    LazySmp(int threadCount, std::function<Minimax*() > factory);
+    ~LazySmp();
+
+    void setTransTable(TransTable*);
+    void setExactTable(ExactTable*);
+    void setEndgameDb(const RetroDb*, int maxPieces = -1);
+    void setVariation(const std::string& variation);
+    int search(int depth = 0, bool newTable = true);
+
+    int getThreadCount() const {
+        return engines.size();
+    }
+
+    //the main engine runs on the calling thread and can be used for reporting
+    Minimax* getEngine(int id = 0) {
+        return engines[id];
+    }
+
+    //totals over all threads
+    uint64_t interiorCount;
+    uint64_t reusedCount;
+    uint64_t inexactReusedCount;
+    uint64_t taintedCount;
+    uint64_t terminalCount;
+    uint64_t depthCutoffs;
+    uint64_t endgameHits;
+    //wall-clock time
+    double elapsedSeconds;
+};
+
+#endif
@@ -4,11 +4,12 @@
 #include <cassert>
 #include <algorithm>
 #include <ctime>
+#include <random>
 
 using namespace Connect4;
 
 Minimax::Minimax()
-: trans(NULL) {
+: trans(NULL), exact(NULL), stopFlag(NULL), endgame(NULL), endgamePieces(-1) {
     reportCallback = NULL;
     resetHistory();
     resetStats();
@@ -43,6 +44,10 @@ int Minimax::search(int depth, bool newHistory, bool newTable) {
 char Minimax::getBestMove(int depth) {
     if (hasWon(other)) return 0;
     resetHistory();
+#if TRANS_ON
+    //the table is kept between moves so the entries of the previous moves get older
+    trans->nextGeneration();
+#endif
     Successor succ[WIDTH * 2];
     int moveCount = getSuccessors(succ);
     int quickScore = evaluateTerminals(succ, moveCount);
@@ -79,6 +84,39 @@ void Minimax::setTransTable(TransTable* tt) {
     trans = tt;
 }
 
+void Minimax::setExactTable(ExactTable* et) {
+    exact = et;
+}
+
+void Minimax::setStopFlag(const std::atomic<bool>* flag) {
+    stopFlag = flag;
+}
+
+/**
+ * Probes the database for positions with at most maxPieces pieces, or for all the
+ * positions in it if maxPieces is negative
+ */
+void Minimax::setEndgameDb(const RetroDb* db, int maxPieces) {
+    endgame = db;
+    endgamePieces = db == NULL ? -1 : db->getMaxPieces();
+    if (maxPieces >= 0 && maxPieces < endgamePieces) endgamePieces = maxPieces;
+}
+
+/**
+ * Resets the history and adds a little seeded noise to it so that parallel
+ * searchers try the moves in a different order. Seed 0 gives the normal ordering.
+ */
+void Minimax::perturbHistory(unsigned int seed) {
+    resetHistory();
+    if (seed == 0) return;
+
+    std::minstd_rand random(seed);
+    for (int i = 0; i < WIDTH * (HEIGHT + 1); i++) {
+        dropHistory[i] += random() % WIDTH;
+        popHistory[i] += random() % WIDTH;
+    }
+}
+
 void Minimax::resetHistory() {
     //give middle cells a slightly better score so they are tried first in absence of everything else
     for (int x = 0; x < WIDTH; x++) {
@@ -93,7 +131,26 @@ void Minimax::resetHistory() {
 
 void Minimax::resetStats() {
 
-    interiorCount = terminalCount = reusedCount = inexactReusedCount = taintedCount = depthCutoffs = 0;
+    interiorCount = terminalCount = reusedCount = inexactReusedCount = taintedCount = depthCutoffs = endgameHits = 0;
+}
+
+/**
+ * Returns the exact score of the current position from the endgame database, or
+ * UNKNOWN if the position has too many pieces. The database has every position of
+ * its slices, so the ones it does not know are draws by repetition.
+ */
+int Minimax::probeEndgame() {
+    if (endgame == NULL) return UNKNOWN;
+    //the heights are bit indexes
+    int pieces = 0;
+    for (int i = 0; i < WIDTH; i++) {
+        pieces += heights[i] - i * H1;
+    }
+    if (pieces > endgamePieces) return UNKNOWN;
+
+    endgameHits++;
+    int score = endgame->getScore(getPosition());
+    return score == UNKNOWN ? DRAW : score;
 }
 
 int Minimax::evaluateTerminals(Successor(&succ)[WIDTH * 2], int moveCount) {
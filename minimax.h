@@ -1,10 +1,13 @@
 #ifndef MINIMAX_H
 #define	MINIMAX_H
 
+#include <atomic>
 #include <functional>
 #include "connect4.h"
 #include "game.h"
 #include "transtable.h"
+#include "exacttable.h"
+#include "retrodb.h"
 
 #define TRANS_ON 1
 #define ALPHA_BETA_ON 1
@@ -27,6 +30,10 @@ public:
     char getBestMove(int depth = 0);
 
     void setTransTable(TransTable*);
+    void setExactTable(ExactTable*);
+    void setStopFlag(const std::atomic<bool>*);
+    void setEndgameDb(const RetroDb*, int maxPieces = -1);
+    void perturbHistory(unsigned int seed);
 
     uint64_t interiorCount;
     uint64_t reusedCount;
@@ -34,6 +41,7 @@ public:
     uint64_t taintedCount;
     uint64_t terminalCount;
     uint64_t depthCutoffs;
+    uint64_t endgameHits;
     double elapsedSeconds;
 
     std::function<void() > reportCallback;
@@ -42,6 +50,13 @@ protected:
 #if TRANS_ON
     TransTable* trans;
 #endif
+    //optional store for proven scores that must survive replacement in the table
+    ExactTable* exact;
+    //when set, the search is abandoned as soon as the flag becomes true
+    const std::atomic<bool>* stopFlag;
+    //optional retrograde results for positions with at most endgamePieces pieces
+    const RetroDb* endgame;
+    int endgamePieces;
     int popCount;
     hentry dropHistory[WIDTH * (HEIGHT + 1)];
     hentry popHistory[WIDTH * (HEIGHT + 1)];
@@ -52,6 +67,11 @@ protected:
     void resetStats();
     int evaluateTerminals(Successor(&succ)[WIDTH * 2], int moveCount);
     int order(Successor(&succ)[WIDTH * 2], int moveCount);
+    int probeEndgame();
+
+    bool isStopped() const {
+        return stopFlag != NULL && stopFlag->load(std::memory_order_relaxed);
+    }
 
     hentry& getHistoryScore(int move) {
         if (move >= 0) return dropHistory[heights[move]];
@@ -1,12 +1,19 @@
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 #include "alphabeta.h"
 #include "handicap.h"
+#include "lazysmp.h"
+#include "parallelhandicap.h"
+#include "retrodb.h"
 
 using namespace std;
 
-Handicap game;
+//Lazy SMP is used only when asked for, otherwise the threads split the proof
+LazySmp* lazy = NULL;
+ParallelHandicap* prover = NULL;
 
 int parseColumn(char ch) {
 	for (char& firstSymbol : string("1aA")) {
@@ -17,8 +24,8 @@ int parseColumn(char ch) {
 	return -1;
 }
 
-void check(string variation) {
-	game.reset();
+void check(string variation, int threads, bool newTable) {
+	string moves;
 	for(unsigned int i = 0; i < variation.length(); i++) {
 		char ch = variation.at(i);
 		int x = parseColumn(ch);
@@ -26,22 +33,175 @@ void check(string variation) {
 			cout << "Invalid column: " << ch << endl;
 			return;
 		}
-		game.drop(x);
+		moves += (char) ('a' + x);
 	}
 
 	cout << "Board size is " << BOARD_WIDTH << "x" << BOARD_HEIGHT << endl;
 	cout << "Solving variation: " << variation << endl;
+	if (threads > 1) {
+		cout << "Threads: " << threads << (lazy != NULL ? " (lazy SMP)" : "") << endl;
+	}
 	
-	int result = game.search((BOARD_WIDTH * BOARD_HEIGHT + 1) * 2);
-	cout << "Result: " << Connect4::scoreToString(result) << " in " << game.elapsedSeconds << ", " << game.interiorCount << " nodes" << endl;
+	int result;
+	double elapsed;
+	uint64_t nodes;
+	uint64_t endgameHits;
+	if (lazy != NULL) {
+		lazy->setVariation(moves);
+		result = lazy->search((BOARD_WIDTH * BOARD_HEIGHT + 1) * 2, newTable);
+		elapsed = lazy->elapsedSeconds;
+		nodes = lazy->interiorCount;
+		endgameHits = lazy->endgameHits;
+	} else {
+		prover->setVariation(moves);
+		result = prover->search(newTable);
+		elapsed = prover->elapsedSeconds;
+		nodes = prover->interiorCount;
+		endgameHits = prover->endgameHits;
+	}
+	cout << "Result: " << Connect4::scoreToString(result) << " in " << elapsed << ", " << nodes << " nodes" << endl;
+	if (endgameHits > 0) {
+		cout << "Endgame database hits: " << endgameHits << endl;
+	}
+}
+
+double percent(uint64_t part, uint64_t whole) {
+	return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+void printTableStats(const TransTable& tt) {
+	TransStats stats = tt.getStats();
+	cout << "Transposition table: " << tt.getSize() << " entries in " << tt.getWays() << "-way buckets" << endl;
+#if TRANS_STATS_ON
+	uint64_t hitCount = stats.probes - stats.misses;
+	cout << "  probes " << stats.probes << ", hits " << hitCount << " (" << percent(hitCount, stats.probes) << "%)"
+		<< ", collisions " << stats.collisions << endl;
+	cout << "  hits by slot:";
+	for(int i = 0; i < tt.getWays(); i++) {
+		cout << " " << stats.hits[i];
+	}
+	cout << endl;
+	cout << "  stores " << stats.stores << ", updates " << stats.updates << ", inserts " << stats.inserts
+		<< ", replacements " << stats.replacements << ", exact overwritten " << stats.exactOverwrites << endl;
+#endif
+	uint64_t used = 0;
+	cout << "  buckets by used slots:";
+	for(int i = 0; i <= tt.getWays(); i++) {
+		cout << " " << stats.occupancy[i];
+		used += i * stats.occupancy[i];
+	}
+	cout << " (" << percent(used, tt.getSize()) << "% full)" << endl;
+	cout << "  entries by log2 work:";
+	int last = TransStats::WORK_LEVELS - 1;
+	while(last > 0 && stats.work[last] == 0) last--;
+	for(int i = 0; i <= last; i++) {
+		cout << " " << stats.work[i];
+	}
+	cout << endl;
+}
+
+void usage(char *argv[]) {
+	cout << "Usage: " << argv[0] << " [-l table] [-s table] [-c directory] [-e database] [variation] [threads] [lazy]" << endl;
+	cout << "  -l  continue from a transposition table saved earlier" << endl;
+	cout << "  -s  save the transposition table after solving" << endl;
+	cout << "  -c  spill entries replaced in the table to files in the directory" << endl;
+	cout << "  -e  take the scores of positions with few pieces from a retrograde database" << endl;
 }
 
 int main(int argc, char *argv[]) {
-	TransTable *tt = new TransTable(67108859);
-	game.setTransTable(tt);
 	string var = "";
-	if(argc == 2) var = argv[1];
-	check(var);
+	int threads = 1;
+	bool useLazy = false;
+	string loadFile, saveFile, coldDirectory, endgameFile;
+
+	int position = 0;
+	for(int i = 1; i < argc; i++) {
+		if((strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-s") == 0) && i + 1 < argc) {
+			(argv[i][1] == 'l' ? loadFile : saveFile) = argv[i + 1];
+			i++;
+		} else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			coldDirectory = argv[i + 1];
+			i++;
+		} else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			endgameFile = argv[i + 1];
+			i++;
+		} else if(argv[i][0] == '-') {
+			usage(argv);
+			return 1;
+		} else if(position == 0) {
+			var = argv[i];
+			position++;
+		} else if(position == 1) {
+			threads = atoi(argv[i]);
+			position++;
+		} else {
+			useLazy = strcmp(argv[i], "lazy") == 0;
+		}
+	}
+
+	TransTable *tt;
+	try {
+		if(loadFile.empty()) {
+			tt = new TransTable((uint64_t) 1 << 27);
+		} else {
+			tt = new TransTable(loadFile);
+			cout << "Loaded transposition table: " << loadFile << endl;
+		}
+	} catch(const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	ColdTier *cold = NULL;
+	if(!coldDirectory.empty()) {
+		cold = new ColdTier(coldDirectory);
+		tt->setColdTier(cold);
+	}
+
+	RetroDb *endgame = NULL;
+	if(!endgameFile.empty()) {
+		try {
+			endgame = new RetroDb(endgameFile);
+			cout << "Loaded endgame database: " << endgameFile << ", up to " << endgame->getMaxPieces() << " pieces" << endl;
+		} catch(const std::runtime_error& e) {
+			cerr << e.what() << endl;
+			return 1;
+		}
+	}
+
+	//proven wins are kept here even when the table has to replace them
+	ExactTable *exact = new ExactTable((uint64_t) 1 << 24);
+
+	if(useLazy) {
+		lazy = new LazySmp(threads, []() { return new Handicap(); });
+		lazy->setTransTable(tt);
+		lazy->setExactTable(exact);
+		lazy->setEndgameDb(endgame);
+	} else {
+		prover = new ParallelHandicap(threads);
+		prover->setTransTable(tt);
+		prover->setExactTable(exact);
+		prover->setEndgameDb(endgame);
+	}
+	check(var, threads, loadFile.empty());
+	printTableStats(*tt);
+	if(cold != NULL) {
+		cout << "Cold tier: " << cold->getSpilled() << " spilled in " << cold->getRunCount() << " runs, "
+			<< cold->getProbes() << " probes, " << cold->getBlockReads() << " block reads, " << cold->getHits() << " hits" << endl;
+	}
+
+	if(!saveFile.empty()) {
+		try {
+			tt->save(saveFile);
+			cout << "Saved transposition table: " << saveFile << endl;
+		} catch(const std::runtime_error& e) {
+			cerr << e.what() << endl;
+		}
+	}
+	delete lazy;
+	delete prover;
+	delete exact;
+	delete endgame;
 	delete tt;
+	delete cold;
 }
-
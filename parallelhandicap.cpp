@@ -0,0 +1,351 @@
+#include "parallelhandicap.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace Connect4;
+
+struct SplitPoint {
+    SplitPoint* parent;
+    SplitWorker* owner;
+    //the red node where the split was made
+    std::string variation;
+    //the replies that are left, both as indexes into the owner's successors and as moves
+    int indexes[BOARD_WIDTH * 2];
+    char moves[BOARD_WIDTH * 2];
+    int count;
+    int next;
+    //replies that are being proven at the moment
+    int active;
+    bool cancelled;
+    //combined score from red's perspective
+    int result;
+    bool tainted;
+};
+
+class SplitWorker : public Handicap {
+public:
+    ParallelHandicap* pool;
+    //the innermost split point this worker is working under
+    SplitPoint* split;
+    std::atomic<bool> aborted;
+    uint64_t splitCount;
+
+    SplitWorker(ParallelHandicap* p) : pool(p), split(NULL), aborted(false), splitCount(0) {
+        setStopFlag(&aborted);
+    }
+
+    void prepare(bool parallel) {
+        resetStats();
+        resetHistory();
+        splitting = parallel;
+        split = NULL;
+        aborted = false;
+        splitCount = 0;
+    }
+
+    /**
+     * Proves one reply of a split point made by another worker
+     */
+    int proveTask(SplitPoint* sp, int n) {
+        setVariation(sp->variation);
+        play(sp->moves[n]);
+        popCount = 0;
+        return prove();
+    }
+
+    /**
+     * Proves a reply of a split point made under the given one, which this worker
+     * owns and is waiting for, and then puts the owner's red node back. The replies
+     * of a red node are made with its ply already advanced.
+     */
+    int helpTask(SplitPoint* sp, int n, SplitPoint* own) {
+        int score = proveTask(sp, n);
+        setVariation(own->variation);
+        ply++;
+        pastMoves[ply - 1] = 0;
+        popCount = 0;
+        return score;
+    }
+
+protected:
+    int splitReplies(Successor(&succ)[WIDTH * 2], int first, int moveCount, bool symmetric);
+};
+
+int SplitWorker::splitReplies(Successor(&succ)[WIDTH * 2], int first, int moveCount, bool symmetric) {
+    //ply has already been advanced past the red node
+    if (popCount > 0 || plyLimit - ply < pool->minSplitDepth) return UNKNOWN;
+
+    SplitPoint sp;
+    sp.count = 0;
+    for (int i = first; i < moveCount; i++) {
+        Successor& s = succ[i];
+        if (s.score != UNKNOWN) continue;
+        if (symmetric && s.column > MIDDLE_COLUMN) continue;
+        sp.indexes[sp.count] = i;
+        sp.moves[sp.count] = s.pop ? 'A' + s.column : 'a' + s.column;
+        sp.count++;
+    }
+    if (sp.count < 2) return UNKNOWN;
+
+    splitCount++;
+    sp.owner = this;
+    sp.variation = getVariation();
+    sp.next = 0;
+    sp.active = 0;
+    sp.cancelled = false;
+    sp.result = LOSS;
+    sp.tainted = false;
+    pool->publish(&sp);
+
+    int n;
+    while ((n = pool->claim(&sp)) >= 0) {
+        int score = proveReply(succ[sp.indexes[n]], false);
+        pool->finish(&sp, score);
+    }
+    pool->join(&sp);
+
+    return sp.tainted ? sp.result | TAINTED : sp.result;
+}
+
+static bool isCancelled(SplitPoint* sp) {
+    for (; sp != NULL; sp = sp->parent) {
+        if (sp->cancelled) return true;
+    }
+    return false;
+}
+
+static bool isUnder(SplitPoint* sp, SplitPoint* ancestor) {
+    for (; sp != NULL; sp = sp->parent) {
+        if (sp == ancestor) return true;
+    }
+    return false;
+}
+
+ParallelHandicap::ParallelHandicap(int threadCount) : trans(NULL), finished(false), minSplitDepth(DEFAULT_MIN_SPLIT_DEPTH) {
+    if (threadCount < 1) threadCount = 1;
+    for (int i = 0; i < threadCount; i++) {
+        workers.push_back(new SplitWorker(this));
+    }
+}
+
+ParallelHandicap::~ParallelHandicap() {
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        delete workers[i];
+    }
+}
+
+Handicap* ParallelHandicap::getEngine() {
+    return workers[0];
+}
+
+void ParallelHandicap::setTransTable(TransTable* tt) {
+    trans = tt;
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->setTransTable(tt);
+    }
+}
+
+void ParallelHandicap::setExactTable(ExactTable* et) {
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->setExactTable(et);
+    }
+}
+
+void ParallelHandicap::setEndgameDb(const RetroDb* db, int maxPieces) {
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->setEndgameDb(db, maxPieces);
+    }
+}
+
+void ParallelHandicap::setVariation(const std::string& variation) {
+    //the helpers get their positions from the split points
+    workers[0]->setVariation(variation);
+}
+
+void ParallelHandicap::setPlyLimit(int limit) {
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->plyLimit = limit;
+    }
+}
+
+int ParallelHandicap::search(bool newTable) {
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->prepare(workers.size() > 1);
+    }
+    finished = false;
+#if TRANS_ON
+    if (!newTable) trans->nextGeneration();
+#endif
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> helpers;
+    for (unsigned int i = 1; i < workers.size(); i++) {
+        helpers.push_back(std::thread(&ParallelHandicap::idleLoop, this, workers[i]));
+    }
+
+    int v = workers[0]->search(0, false, newTable);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+    }
+    wakeup.notify_all();
+    for (unsigned int i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    elapsedSeconds = std::chrono::duration<double>(end - begin).count();
+
+    interiorCount = reusedCount = taintedCount = terminalCount = depthCutoffs = endgameHits = splitCount = 0;
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        SplitWorker* worker = workers[i];
+        interiorCount += worker->interiorCount;
+        reusedCount += worker->reusedCount;
+        taintedCount += worker->taintedCount;
+        terminalCount += worker->terminalCount;
+        depthCutoffs += worker->depthCutoffs;
+        endgameHits += worker->endgameHits;
+        splitCount += worker->splitCount;
+    }
+    return v;
+}
+
+void ParallelHandicap::idleLoop(SplitWorker* worker) {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!finished) {
+        SplitPoint* sp = findWork();
+        if (sp == NULL) {
+            wakeup.wait(guard);
+            continue;
+        }
+
+        int n = sp->next++;
+        sp->active++;
+        worker->split = sp;
+        worker->aborted = false;
+        guard.unlock();
+
+        int score = worker->proveTask(sp, n);
+
+        guard.lock();
+        worker->split = NULL;
+        record(sp, score);
+    }
+}
+
+/**
+ * Returns the split point closest to the root that still has replies left, only
+ * from the ones made under the given split point if there is one
+ */
+SplitPoint* ParallelHandicap::findWork(SplitPoint* under) {
+    SplitPoint* best = NULL;
+    for (unsigned int i = 0; i < splitPoints.size(); i++) {
+        SplitPoint* sp = splitPoints[i];
+        if (sp->next == sp->count || isCancelled(sp)) continue;
+        if (under != NULL && !isUnder(sp, under)) continue;
+        if (best == NULL || sp->variation.length() < best->variation.length()) {
+            best = sp;
+        }
+    }
+    return best;
+}
+
+void ParallelHandicap::publish(SplitPoint* sp) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        sp->parent = sp->owner->split;
+        sp->owner->split = sp;
+        splitPoints.push_back(sp);
+    }
+    wakeup.notify_all();
+}
+
+/**
+ * Returns the index of the next reply for the owner of the split point or -1 if
+ * there are none left
+ */
+int ParallelHandicap::claim(SplitPoint* sp) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (sp->cancelled || sp->next == sp->count) return -1;
+    sp->active++;
+    return sp->next++;
+}
+
+void ParallelHandicap::finish(SplitPoint* sp, int score) {
+    std::lock_guard<std::mutex> guard(lock);
+    record(sp, score);
+}
+
+/**
+ * Adds the score of a reply (from white's perspective) to the split point. The lock
+ * must be held.
+ */
+void ParallelHandicap::record(SplitPoint* sp, int score) {
+    sp->active--;
+    if (!sp->cancelled) {
+        bool tainted = (score & TAINTED) != 0;
+        if (SCORE_CEILING - (score & ~TAINTED) == WIN) {
+            sp->result = WIN;
+            sp->tainted = tainted;
+            cancel(sp);
+        } else {
+            sp->tainted |= tainted;
+        }
+    }
+    if (sp->active == 0) wakeup.notify_all();
+}
+
+/**
+ * Stops every worker that is working under the split point. The lock must be held.
+ */
+void ParallelHandicap::cancel(SplitPoint* sp) {
+    sp->cancelled = true;
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        for (SplitPoint* p = workers[i]->split; p != NULL; p = p->parent) {
+            if (p == sp) {
+                workers[i]->aborted = true;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Waits until the helpers have finished their replies and removes the split point.
+ * While it waits the owner proves replies of the split points that its helpers
+ * made. Those belong to the replies it waits for, so the split point cannot be
+ * done before the owner is back from helping.
+ */
+void ParallelHandicap::join(SplitPoint* sp) {
+    std::unique_lock<std::mutex> guard(lock);
+    SplitWorker* owner = sp->owner;
+    while (sp->active > 0) {
+        SplitPoint* help = findWork(sp);
+        if (help == NULL) {
+            wakeup.wait(guard);
+            continue;
+        }
+
+        int n = help->next++;
+        help->active++;
+        owner->split = help;
+        owner->aborted = false;
+        guard.unlock();
+
+        int score = owner->helpTask(help, n, sp);
+
+        guard.lock();
+        owner->split = sp;
+        record(help, score);
+    }
+
+    for (unsigned int i = 0; i < splitPoints.size(); i++) {
+        if (splitPoints[i] == sp) {
+            splitPoints.erase(splitPoints.begin() + i);
+            break;
+        }
+    }
+    owner->split = sp->parent;
+    owner->aborted = isCancelled(sp->parent);
+}
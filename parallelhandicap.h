@@ -0,0 +1,75 @@
+#ifndef PARALLELHANDICAP_H
+#define	PARALLELHANDICAP_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "handicap.h"
+
+class SplitWorker;
+struct SplitPoint;
+
+/**
+ * Proves handicap positions on several threads with Young Brothers Wait splitting.
+ * On red nodes every reply must be refuted, so once the first reply has been
+ * refuted the remaining ones are published as a split point. Idle threads take
+ * replies from the split points, each with its own game state, and all threads
+ * share the transposition table. When red finds a reply that is not refuted, the
+ * other threads working under the same split point are stopped.
+ */
+class ParallelHandicap {
+    friend class SplitWorker;
+
+    std::vector<SplitWorker*> workers;
+    TransTable* trans;
+    std::vector<SplitPoint*> splitPoints;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool finished;
+
+    void idleLoop(SplitWorker* worker);
+    SplitPoint* findWork(SplitPoint* under = NULL);
+    void publish(SplitPoint* sp);
+    int claim(SplitPoint* sp);
+    void finish(SplitPoint* sp, int score);
+    void record(SplitPoint* sp, int score);
+    void cancel(SplitPoint* sp);
+    void join(SplitPoint* sp);
+
+public:
+    //splits are made only if at least this many plies remain before the ply limit
+    static const int DEFAULT_MIN_SPLIT_DEPTH = 8;
+
+    ParallelHandicap(int threadCount);
+    ~ParallelHandicap();
+
+    void setTransTable(TransTable*);
+    void setExactTable(ExactTable*);
+    void setEndgameDb(const RetroDb*, int maxPieces = -1);
+    void setVariation(const std::string& variation);
+    void setPlyLimit(int limit);
+    int search(bool newTable = true);
+
+    int getThreadCount() const {
+        return workers.size();
+    }
+
+    //the main worker runs on the calling thread and can be used for reporting
+    Handicap* getEngine();
+
+    int minSplitDepth;
+
+    //totals over all threads
+    uint64_t interiorCount;
+    uint64_t reusedCount;
+    uint64_t taintedCount;
+    uint64_t terminalCount;
+    uint64_t depthCutoffs;
+    uint64_t endgameHits;
+    uint64_t splitCount;
+    //wall-clock time
+    double elapsedSeconds;
+};
+
+#endif
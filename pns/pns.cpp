@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <fstream>
 #include <sstream>
@@ -7,6 +8,8 @@
 #include <ctime>
 
 #include "proof.h"
+#include "dfpn.h"
+#include "proofdag.h"
 #include "alphabeta.h"
 #include "handicap.h"
 
@@ -14,9 +17,11 @@ using namespace std;
 using namespace Connect4;
 
 Proof game;
+DfPn* dfpn = NULL;
+ProofDag* dag = NULL;
 
 enum Mode {
-	White, Red, Exact
+	White, SecondLevel, Red, Exact, DepthFirst, DagWhite, DagRed, DagExact
 };
 
 
@@ -34,6 +39,7 @@ void check(string variation, Mode mode) {
 	int result;
 	switch(mode) {
 		case White:
+		case SecondLevel:
 			result = game.solve(true);
 			break;
 		case Red:
@@ -42,10 +48,33 @@ void check(string variation, Mode mode) {
 		case Exact:
 			result = game.exactSolve();
 			break;
+		case DepthFirst:
+			dfpn->setVariation(variation);
+			result = dfpn->solve();
+			break;
+		case DagWhite:
+		case DagRed:
+		case DagExact:
+			dag->setVariation(variation);
+			result = mode == DagExact ? dag->exactSolve() : dag->solve(mode == DagWhite);
+			break;
 	}
 	end = clock();
 	duration = (double) (end - begin) / CLOCKS_PER_SEC;
 	cout << "Score: " << result << " in " << duration << " seconds" << endl;
+	if(mode == White || mode == SecondLevel || mode == Red || mode == Exact) {
+		cout << "Expanded " << game.expansions << " nodes";
+		if(mode == SecondLevel || game.threadCount > 1) cout << ", " << game.secondLevelExpansions << " in second level searches";
+		cout << ", " << game.collections << " garbage collections" << endl;
+	}
+	if(mode == DepthFirst) {
+		cout << "Searched " << dfpn->expansions << " nodes, " << dfpn->tableHits << " table hits, "
+			<< dfpn->replacements << " replacements" << endl;
+	}
+	if(mode == DagWhite || mode == DagRed || mode == DagExact) {
+		cout << "Expanded " << dag->expansions << " positions, " << dag->getNodeCount() << " nodes, "
+			<< dag->transpositions << " transpositions, " << dag->getBytes() / (1024 * 1024) << " MB" << endl;
+	}
 	switch(result) {
 		case WIN:
 			cout << (whiteMoves?"White wins":"Red wins") << endl;
@@ -76,7 +105,11 @@ void checkFile() {
 }
 
 void usage(char *argv[]) {
-	std::cout << "Usage: " << argv[0] << " white/red/exact variation" << std::endl;
+	std::cout << "Usage: " << argv[0] << " white/pn2/red/exact/dfpn/dag/dagred/dagexact variation [node budget] [threads] [uniform/mobility/threats]" << std::endl;
+	std::cout << "  pn2  white with a second level search at the leaves" << std::endl;
+	std::cout << "  the node budget in millions bounds the tree of white, pn2, red and exact, at least " << Proof::MIN_NODE_BUDGET / 1000000.0 << std::endl;
+	std::cout << "  with more than one thread the leaves of white, pn2, red and exact are searched in parallel" << std::endl;
+	std::cout << "  the last argument sets the numbers of new leaves, uniform by default" << std::endl;
 	std::cout << "Example: " << argv[0] << " white dda" << std::endl;	
 }
 
@@ -88,18 +121,46 @@ int main(int argc, char *argv[]) {
 	Mode mode;
 	if(std::strcmp(argv[1], "white") == 0) {
 		mode = White;	
+	}	else if(std::strcmp(argv[1], "pn2") == 0) {
+		mode = SecondLevel;
+		game.secondLevelLimit = Proof::DEFAULT_SECOND_LEVEL_LIMIT;
 	}	else if(std::strcmp(argv[1], "red") == 0) {
 		mode = Red;	
 	}	else if(std::strcmp(argv[1], "exact") == 0) {
 		mode = Exact;	
+	}	else if(std::strcmp(argv[1], "dfpn") == 0) {
+		mode = DepthFirst;
+		dfpn = new DfPn();
+	}	else if(std::strcmp(argv[1], "dag") == 0) {
+		mode = DagWhite;
+	}	else if(std::strcmp(argv[1], "dagred") == 0) {
+		mode = DagRed;
+	}	else if(std::strcmp(argv[1], "dagexact") == 0) {
+		mode = DagExact;
 	} else {
 		usage(argv);
 		exit(1);
 	}
 
+	if(mode == DagWhite || mode == DagRed || mode == DagExact) {
+		dag = new ProofDag();
+	}
+
 	string var = "";
 	
-	if(argc == 3) var = argv[2];
+	if(argc >= 3) var = argv[2];
+	if(argc >= 4) game.nodeBudget = (uint64_t) (atof(argv[3]) * 1000000);
+	if(argc >= 5) game.threadCount = std::max(1, atoi(argv[4]));
+	if(argc >= 6) {
+		if(std::strcmp(argv[5], "mobility") == 0) {
+			game.initialization = Proof::MOBILITY;
+		} else if(std::strcmp(argv[5], "threats") == 0) {
+			game.initialization = Proof::THREATS;
+		} else if(std::strcmp(argv[5], "uniform") != 0) {
+			usage(argv);
+			exit(1);
+		}
+	}
 	try {
 		check(var, mode);
 	}catch(const std::invalid_argument& e) {
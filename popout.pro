@@ -6,13 +6,19 @@ INCLUDEPATH += .
 DEFINES += QT_DEPRECATED_WARNINGS
 
 HEADERS += alphabeta.h \
+           coldtier.h \
            connect4.h \
+           exacttable.h \
            full.h \
            game.h \
            handicap.h \
+           lazysmp.h \
            minimax.h \
+           parallelhandicap.h \
            proof.h \
            retro.h \
+           retrodb.h \
+           retroindex.h \
            settings.h \
            transtable.h \
            gui/BoardWidget.h \
@@ -20,13 +26,19 @@ HEADERS += alphabeta.h \
            gui/SearchWidget.h \
            gui/SearchWorker.h
 SOURCES += alphabeta.cpp \
+           coldtier.cpp \
            connect4.cpp \
+           exacttable.cpp \
            full.cpp \
            game.cpp \
            handicap.cpp \
+           lazysmp.cpp \
            minimax.cpp \
+           parallelhandicap.cpp \
            proof.cpp \
            retro.cpp \
+           retrodb.cpp \
+           retroindex.cpp \
            transtable.cpp \
            gui/BoardWidget.cpp \
            gui/MainWindow.cpp \
@@ -1,12 +1,102 @@
 #include "proof.h"
 #include <algorithm>
 #include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
 #include <cassert>
+#include <thread>
 
 using namespace Connect4;
 
-int Proof::solve(bool white) {
+//the rows from the bottom, every other one
+static bitboard getRows(int first) {
+    bitboard rows = 0;
+    for (int y = first; y < HEIGHT; y += 2) {
+        rows |= BOTTOM << y;
+    }
+    return rows;
+}
+
+//white wants its threats on the odd rows counting from 1, red on the even ones
+static const bitboard WHITE_ROWS = getRows(0);
+static const bitboard RED_ROWS = getRows(1);
+
+/**
+ * The empty cells that would give the player four in a row. The empty bit above
+ * each column keeps the lines from running into the next column.
+ */
+static bitboard getThreats(bitboard player, bitboard empty) {
+    bitboard threats = (player << 1) & (player << 2) & (player << 3);
+    const int shifts[] = {H1, HEIGHT, H2};
+    for (int i = 0; i < 3; i++) {
+        int d = shifts[i];
+        bitboard pair = (player << d) & (player << 2 * d);
+        threats |= pair & (player << 3 * d);
+        threats |= pair & (player >> d);
+        pair = (player >> d) & (player >> 2 * d);
+        threats |= pair & (player << d);
+        threats |= pair & (player >> 3 * d);
+    }
+    return threats & empty;
+}
+
+NodeArena::NodeArena() : slab(0), used(1), freeNodes(0), allocations(0) {
+    std::fill(freeLists, freeLists + MAX_CHILDREN + 1, NO_CHILDREN);
+}
+
+NodeArena::~NodeArena() {
+    for (unsigned int i = 0; i < slabs.size(); i++) {
+        delete[] slabs[i];
+    }
+}
+
+uint32_t NodeArena::allocate(int count) {
+    assert(count > 0 && count <= MAX_CHILDREN);
+    allocations++;
+    uint32_t nodes = freeLists[count];
+    if (nodes != NO_CHILDREN) {
+        freeLists[count] = get(nodes)->children;
+        freeNodes -= count;
+        return nodes;
+    }
+
+    //the end of a full slab is left unused
+    if (slab >= slabs.size() || used + count > SLAB_NODES) {
+        if (slab < slabs.size()) slab++;
+        if (slab == slabs.size()) {
+            //the index of a node has 32 bits
+            if (slabs.size() >= (size_t) 1 << (32 - SLAB_BITS)) throw std::bad_alloc();
+            slabs.push_back(new Node[SLAB_NODES]);
+        }
+        used = 0;
+    }
+    nodes = (slab << SLAB_BITS) + used;
+    used += count;
+    return nodes;
+}
+
+void NodeArena::release(uint32_t nodes, int count) {
+    get(nodes)->children = freeLists[count];
+    freeLists[count] = nodes;
+    freeNodes += count;
+}
+
+void NodeArena::reset() {
+    std::fill(freeLists, freeLists + MAX_CHILDREN + 1, NO_CHILDREN);
+    freeNodes = 0;
+    slab = 0;
+    used = 1;
+}
+
+int Proof::solve(bool white, bool withHandicap) {
+    if (nodeBudget > 0 && nodeBudget < MIN_NODE_BUDGET) {
+        std::stringstream ss;
+        ss << "Node budget below the minimum of " << MIN_NODE_BUDGET << " nodes";
+        throw std::invalid_argument(ss.str());
+    }
     solveRed = !white;
+    handicap = white && withHandicap;
     bool solverMoves = (ply % 2 == 0) ^ solveRed;
 
     if (Connect4::hasWon(other)) {
@@ -16,33 +106,171 @@ int Proof::solve(bool white) {
         return WIN;
     }
 
-    expansions = allocated = 0;
-    Node root;
-    //root.disjunction = true;
-    root.disjunction = solverMoves;
-    root.expanded = false;
-    root.parent = NULL;
-    root.value = UNKNOWN;
-    setProofNumbers(&root);
-    Node* current = &root;
-    while (root.proof != 0 && root.disproof != 0) {
-        Node* mostProving = selectMostProvingNode(current);
-        expand(mostProving);
-        current = updateAncestors(mostProving, &root);
-    }
-
-    freeChildren(&root);
-    if (root.proof == 0) {
+    secondLevelExpansions = 0;
+    collections = 0;
+    Node* root = start(current, other, ply);
+    run(0);
+    int proof = root->proof;
+    int disproof = root->disproof;
+
+    //expand leaves the board at the last leaf
+    setBoard(path[0].current, path[0].other, rootPly);
+    //the whole tree goes at once
+    arena.reset();
+    allocated = 0;
+    if (proof == 0) {
         return solverMoves ? WIN : LOSS;
     }
-    if (root.disproof == 0) {
+    if (disproof == 0) {
         return solverMoves ? DRAW_OR_LOSS : DRAW_OR_WIN;
     }
     return UNKNOWN;
 }
 
+/**
+ * Puts a new root for the board in the arena, the tree of the last search is gone
+ */
+Node* Proof::start(bitboard rootCurrent, bitboard rootOther, int startPly) {
+    expansions = allocated = 0;
+    arena.reset();
+    rootPly = startPly;
+    setBoard(rootCurrent, rootOther, startPly);
+    Level level;
+    level.node = arena.allocate(1);
+    level.current = rootCurrent;
+    level.other = rootOther;
+    Node* root = arena.get(level.node);
+    //root->disjunction = true;
+    root->disjunction = (startPly % 2 == 0) ^ solveRed;
+    root->expanded = false;
+    root->busy = false;
+    root->collapsed = false;
+    root->move = 0;
+    root->value = UNKNOWN;
+    root->children = NO_CHILDREN;
+    root->childrenCount = 0;
+    root->proof = root->disproof = 1;
+    path.assign(1, level);
+    return root;
+}
+
+/**
+ * Searches until the root is solved or the expansions reach the limit, 0 for no limit
+ */
+void Proof::run(int expansionLimit) {
+    if (threadCount > 1 && expansionLimit == 0) {
+        inFlight = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < threadCount; i++) {
+            threads.push_back(std::thread(&Proof::work, this));
+        }
+        for (unsigned int i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+        path.resize(1);
+        return;
+    }
+
+    Node* root = arena.get(path[0].node);
+    while (root->proof != 0 && root->disproof != 0) {
+        if (expansionLimit > 0 && expansions >= expansionLimit) break;
+        if (nodeBudget > 0 && (uint64_t) allocated > nodeBudget) {
+            collectGarbage();
+        }
+        selectMostProvingNode(path);
+        Node* leaf = arena.get(path.back().node);
+        int oldProof = leaf->proof;
+        int oldDisproof = leaf->disproof;
+        if (secondLevelLimit > 0 && leaf->move != '.') {
+            if (secondLevel == NULL) {
+                secondLevel = new Proof();
+            }
+            LeafResult result;
+            searchLeaf(secondLevel, path, secondLevelLimit, result);
+            secondLevelExpansions += result.expansions;
+            applyLeafResult(leaf, path, result);
+        } else {
+            expand(leaf, path);
+        }
+        if (leaf->collapsed) keepNumbers(leaf, oldProof, oldDisproof);
+        updateAncestors(path);
+    }
+}
+
+/**
+ * A thread of the parallel search. The tree is only touched under treeLock, the
+ * second level searches run outside it. A leaf being searched is busy and its
+ * numbers are raised by VIRTUAL_NUMBER until its result is in, so the other
+ * threads go for other leaves. The garbage is collected when no leaf is out.
+ */
+void Proof::work() {
+    Proof search;
+    int limit = secondLevelLimit > 0 ? secondLevelLimit : DEFAULT_SECOND_LEVEL_LIMIT;
+    std::vector<Level> levels;
+    std::vector<Level> job;
+    LeafResult result;
+
+    std::unique_lock<std::mutex> guard(treeLock);
+    Node* root = arena.get(path[0].node);
+    while (root->proof != 0 && root->disproof != 0) {
+        if (nodeBudget > 0 && (uint64_t) allocated > nodeBudget) {
+            //no new leaves go out until the searched ones are back
+            if (inFlight > 0) {
+                jobDone.wait(guard);
+                continue;
+            }
+            collectGarbage();
+        }
+        levels.assign(1, path[0]);
+        selectMostProvingNode(levels);
+        Node* leaf = arena.get(levels.back().node);
+        if (leaf->busy) {
+            //the most proving leaf is still being searched by another thread
+            jobDone.wait(guard);
+            continue;
+        }
+        if (leaf->move == '.') {
+            expand(leaf, levels);
+            updateAncestors(levels);
+            continue;
+        }
+        leaf->busy = true;
+        leaf->proof += VIRTUAL_NUMBER;
+        leaf->disproof += VIRTUAL_NUMBER;
+        job = levels;
+        //the leaf keeps the raised numbers, so its ancestors are updated from its parent up
+        if (levels.size() > 1) {
+            levels.pop_back();
+            updateAncestors(levels);
+        }
+        inFlight++;
+
+        guard.unlock();
+        searchLeaf(&search, job, limit, result);
+        guard.lock();
+
+        inFlight--;
+        secondLevelExpansions += result.expansions;
+        //the leaf was freed if a node above it was solved meanwhile
+        if (isOnTree(job)) {
+            leaf = arena.get(job.back().node);
+            leaf->busy = false;
+            leaf->proof -= VIRTUAL_NUMBER;
+            leaf->disproof -= VIRTUAL_NUMBER;
+            int oldProof = leaf->proof;
+            int oldDisproof = leaf->disproof;
+            applyLeafResult(leaf, job, result);
+            if (leaf->collapsed) keepNumbers(leaf, oldProof, oldDisproof);
+            updateAncestors(job);
+        }
+        jobDone.notify_all();
+    }
+    jobDone.notify_all();
+}
+
 int Proof::exactSolve() {
-    int white = solve(true);
+    //white under the handicap not winning does not make it a draw
+    int white = solve(true, false);
     if ((white & 1) != 0) {
         return white;
     }
@@ -59,56 +287,62 @@ int Proof::exactSolve() {
     return DRAW;
 }
 
-Node* Proof::selectMostProvingNode(Node* n) {
+/**
+ * Follows the most proving children down from the end of the levels to a leaf.
+ * The board of each level is made from the one above it.
+ */
+void Proof::selectMostProvingNode(std::vector<Level>& levels) {
+    Node* n = arena.get(levels.back().node);
     while (n->expanded) {
-        Node* best = NULL;
-        if (n->disjunction) {
-            for (int i = 0; i < n->childrenCount; i++) {
-                Node* c = &n->children[i];
-                if (n->proof == c->proof) {
-                    best = c;
-                    break;
-                }
-            }
+        assert(n->childrenCount > 0);
+        Level next = levels.back();
+        next.node = n->children + n->best;
+        n = arena.get(next.node);
+        if (n->move >= 'A' && n->move < 'A' + WIDTH) {
+            Connect4::pop(next.current, next.other, n->move - 'A');
         } else {
-            for (int i = 0; i < n->childrenCount; i++) {
-                Node* c = &n->children[i];
-                if (n->disproof == c->disproof) {
-                    best = c;
-                    break;
-                }
-            }
+            Connect4::drop(next.current, next.other, n->move - 'a');
         }
-        assert(best != NULL);
-        n = best;
-
-        play(n->move);
+        levels.push_back(next);
     }
-    return n;
 }
 
 void Proof::setProofNumbers(Node* n) {
 
     if (n->expanded) {
+        Node* children = arena.get(n->children);
+        int count = n->childrenCount;
+        //the children are summed in locals, the node is written once
+        int proof, disproof;
+        int best = 0;
         if (n->disjunction) {
             //OR node
-            n->proof = INF;
-            n->disproof = 0;
-            for (int i = 0; i < n->childrenCount; i++) {
-                Node& c = n->children[i];
-                n->disproof += c.disproof;
-                n->proof = std::min(n->proof, c.proof);
+            proof = INF;
+            disproof = 0;
+            for (int i = 0; i < count; i++) {
+                Node& c = children[i];
+                disproof += c.disproof;
+                if (c.proof < proof) {
+                    proof = c.proof;
+                    best = i;
+                }
             }
         } else {
             //AND node
-            n->proof = 0;
-            n->disproof = INF;
-            for (int i = 0; i < n->childrenCount; i++) {
-                Node& c = n->children[i];
-                n->proof += c.proof;
-                n->disproof = std::min(n->disproof, c.disproof);
+            proof = 0;
+            disproof = INF;
+            for (int i = 0; i < count; i++) {
+                Node& c = children[i];
+                proof += c.proof;
+                if (c.disproof < disproof) {
+                    disproof = c.disproof;
+                    best = i;
+                }
             }
         }
+        n->proof = proof;
+        n->disproof = disproof;
+        n->best = best;
     } else {
         switch (n->value) {
             case PROVEN:
@@ -120,12 +354,12 @@ void Proof::setProofNumbers(Node* n) {
                 n->disproof = 0;
                 break;
             default:
-                n->proof = 1;
-                n->disproof = 1;
+                //a leaf keeps the numbers it was given, 1 and 1 unless PN2 or a collapse set them
+                break;
         }
     }
 
-    if (n->proof == 0 || n->disproof == 0) {
+    if ((n->proof == 0 || n->disproof == 0) && n->childrenCount > 0) {
         freeChildren(n);
     }
 }
@@ -150,7 +384,11 @@ int Proof::evaluateChildWithHandicap(Successor& s) {
     return UNKNOWN;
 }
 
-int Proof::evaluateChild(Successor& s) {
+/**
+ * The full rules, for red and the exact white. A move back to a position of the game so far is a draw,
+ * which red does not want either.
+ */
+int Proof::evaluateChild(Successor& s, const std::vector<Level>& levels) {
 
     bool whiteMoves = ply % 2 == 0;
 
@@ -162,10 +400,11 @@ int Proof::evaluateChild(Successor& s) {
         //value = parent->disjunction ? DISPROVEN : PROVEN;
         value = whiteMoves ^ solveRed ? DISPROVEN : PROVEN;
     } else {
-        //check repeated position
+        //check repeated position, the positions below the root are on the path
         bitboard pos = BOTTOM + s.newCurrent + s.newCurrent + s.newOther;
         for (int j = ply - 3; j >= 0; j -= 2) {
-            if (pos == pastPositions[j]) {
+            const Level* level = j >= rootPly ? &levels[j - rootPly] : NULL;
+            if (pos == (level != NULL ? Connect4::getPosition(level->current, level->other) : pastPositions[j])) {
                 value = DISPROVEN;
                 break;
             }
@@ -174,7 +413,7 @@ int Proof::evaluateChild(Successor& s) {
     return value;
 }
 
-void Proof::expand(Node* parent) {
+void Proof::expand(Node* parent, const std::vector<Level>& levels) {
     expansions++;
     if (reportCallback != NULL && expansions % 100000 == 0) {
         reportCallback();
@@ -184,63 +423,306 @@ void Proof::expand(Node* parent) {
         parent->expanded = true;
         return;
     }
+    const Level& leaf = levels.back();
+    setBoard(leaf.current, leaf.other, rootPly + levels.size() - 1);
 
     Successor succ[WIDTH * 2];
     int count = getSuccessors(succ, false);
 
     if ((current | other) == FULL) {
         parent->childrenCount = count + 1;
-        parent->children = new Node[count + 1];
+        parent->children = arena.allocate(count + 1);
 
-        Node& n = parent->children[count];
+        Node& n = arena.get(parent->children)[count];
         n.value = DISPROVEN;
         n.move = '.';
         n.disjunction = !parent->disjunction;
+        n.children = NO_CHILDREN;
         n.childrenCount = 0;
         n.expanded = false;
+        n.busy = false;
+        n.collapsed = false;
         setProofNumbers(&n);
     } else {
         parent->childrenCount = count;
-        parent->children = new Node[count];
+        parent->children = arena.allocate(count);
     }
     allocated += parent->childrenCount;
 
+    Node* children = arena.get(parent->children);
     for (int i = 0; i < count; i++) {
         Successor& s = succ[i];
 
-        Node& n = parent->children[i];
-        n.value = evaluateChildWithHandicap(s);
+        Node& n = children[i];
+        n.value = handicap ? evaluateChildWithHandicap(s) : evaluateChild(s, levels);
         n.move = s.pop ? 'A' + s.column : 'a' + s.column;
         n.disjunction = !parent->disjunction;
         n.expanded = false;
-        n.parent = parent;
+        n.busy = false;
+        n.collapsed = false;
+        n.children = NO_CHILDREN;
         n.childrenCount = 0;
+        n.proof = n.disproof = 1;
+        if (n.value == UNKNOWN && initialization != UNIFORM) {
+            initializeNumbers(n, s);
+        }
 
         setProofNumbers(&n);
     }
     parent->expanded = true;
 }
 
-Node* Proof::updateAncestors(Node *n, Node* root) {
-    while (n != root) {
+/**
+ * The numbers of a new child from its board, the leaf's board is set. The player
+ * to move at the child has to have every move refuted, and the player who just
+ * moved only needs one.
+ */
+void Proof::initializeNumbers(Node& n, const Successor& s) {
+    bitboard mover = s.newCurrent;
+    bitboard waiting = s.newOther;
+    bitboard occupied = mover | waiting;
+    bitboard empty = FULL & ~occupied;
+    //the cell a drop fills in each column that is not full
+    bitboard playable = (occupied + BOTTOM) & FULL;
+    bool moverWhite = ply % 2 == 1;
+
+    int moves = countBits(playable);
+#if POPOUT_ON
+    //white pops are refuted at once under the handicap
+    if (!handicap || !moverWhite) {
+        moves += countBits(mover & BOTTOM);
+    }
+#endif
+    //the numbers for the player to move winning and for it being refuted
+    int win = 1;
+    int refute = std::max(moves, 1);
+
+    if (initialization == THREATS) {
+        bitboard moverThreats = getThreats(mover, empty);
+        if (moverThreats & playable) {
+            //a drop cannot complete a line of the other player, so this is a win
+            n.value = n.disjunction ? PROVEN : DISPROVEN;
+            return;
+        }
+        bitboard waitingThreats = getThreats(waiting, empty);
+        int forced = countBits(waitingThreats & playable);
+        if (forced > 0) {
+            //the player to move has to block, or pop below the threat
+            win += 2 * forced;
+            refute = 1;
+        }
+        bitboard moverRows = moverWhite ? WHITE_ROWS : RED_ROWS;
+        bitboard waitingRows = moverWhite ? RED_ROWS : WHITE_ROWS;
+        int edge = countBits(moverThreats & moverRows & ~playable)
+                - countBits(waitingThreats & waitingRows & ~playable);
+        if (edge > 0) {
+            refute += edge;
+        } else {
+            win -= edge;
+        }
+    }
+    n.proof = n.disjunction ? win : refute;
+    n.disproof = n.disjunction ? refute : win;
+}
+
+/**
+ * PN2. The leaf at the end of the levels is searched by a second proof-number
+ * search, which only reads the levels, so the threads run it outside the lock.
+ */
+void Proof::searchLeaf(Proof* search, const std::vector<Level>& levels, int limit, LeafResult& result) {
+    search->solveRed = solveRed;
+    search->handicap = handicap;
+    search->handicapPlyLimit = handicapPlyLimit;
+    search->initialization = initialization;
+    const Level& level = levels.back();
+    int leafPly = rootPly + levels.size() - 1;
+    if (!handicap) {
+        //the repetitions of the second search go back through the levels and the game
+        if (search->pastSize <= leafPly) search->resizePast(leafPly + 1);
+        for (int j = 0; j < leafPly; j++) {
+            search->pastPositions[j] = j < rootPly ? pastPositions[j]
+                    : Connect4::getPosition(levels[j - rootPly].current, levels[j - rootPly].other);
+        }
+    }
+    Node* root = search->start(level.current, level.other, leafPly);
+    search->run(limit);
+    result.expansions = search->expansions;
+
+    if (root->proof == 0 || root->disproof == 0) {
+        result.value = root->proof == 0 ? PROVEN : DISPROVEN;
+        result.count = 0;
+        return;
+    }
+    result.value = UNKNOWN;
+    result.count = root->childrenCount;
+    Node* searched = search->arena.get(root->children);
+    for (int i = 0; i < result.count; i++) {
+        result.proofs[i] = searched[i].proof;
+        result.disproofs[i] = searched[i].disproof;
+    }
+}
+
+/**
+ * A solved leaf takes the result, otherwise it is expanded and its children take
+ * the numbers of the children of the second search's root.
+ */
+void Proof::applyLeafResult(Node* leaf, const std::vector<Level>& levels, const LeafResult& result) {
+    if (result.value != UNKNOWN) {
+        leaf->value = result.value;
+        return;
+    }
+    //the second search expanded its root first, so the children are in the same order
+    expand(leaf, levels);
+    assert(leaf->childrenCount == result.count);
+    Node* children = arena.get(leaf->children);
+    for (int i = 0; i < result.count; i++) {
+        Node& c = children[i];
+        if (c.value != UNKNOWN) continue;
+        c.proof = result.proofs[i];
+        c.disproof = result.disproofs[i];
+        if (c.proof == 0) c.value = PROVEN;
+        if (c.disproof == 0) c.value = DISPROVEN;
+    }
+}
+
+/**
+ * Whether the levels still lead from the root to an unexpanded leaf. Solved nodes
+ * free their children, so a leaf is gone when a node above it was solved.
+ */
+bool Proof::isOnTree(const std::vector<Level>& levels) {
+    for (unsigned int i = 1; i < levels.size(); i++) {
+        const Node* parent = arena.get(levels[i - 1].node);
+        if (!parent->expanded || levels[i].node < parent->children
+                || levels[i].node >= parent->children + parent->childrenCount) {
+            return false;
+        }
+    }
+    return !arena.get(levels.back().node)->expanded;
+}
+
+/**
+ * Updates the proof numbers up the levels until they no longer change. The levels
+ * are left at the node where the next search starts.
+ */
+void Proof::updateAncestors(std::vector<Level>& levels) {
+    while (true) {
+        Node* n = arena.get(levels.back().node);
         int oldProof = n->proof;
         int oldDisproof = n->disproof;
         setProofNumbers(n);
-        if (n->proof == oldProof && n->disproof == oldDisproof) return n;
-        n = n->parent;
-        undo();
+        if (levels.size() == 1 || (n->proof == oldProof && n->disproof == oldDisproof)) return;
+        levels.pop_back();
     }
-    setProofNumbers(root);
-    return root;
 }
 
 void Proof::freeChildren(Node* node) {
     if (node->childrenCount == 0) return;
 
-    for (int i = 0; i < node->childrenCount; i++) {
-        freeChildren(&node->children[i]);
-    }
-    allocated -= node->childrenCount;
-    delete[] node->children;
+    freeStack.push_back(std::make_pair(node->children, (int) node->childrenCount));
     node->childrenCount = 0;
+    while (!freeStack.empty()) {
+        uint32_t children = freeStack.back().first;
+        int count = freeStack.back().second;
+        freeStack.pop_back();
+        //the children are read before release links the array into a free list
+        for (int i = 0; i < count; i++) {
+            Node* c = arena.get(children + i);
+            if (c->childrenCount > 0) {
+                freeStack.push_back(std::make_pair(c->children, (int) c->childrenCount));
+            }
+        }
+        allocated -= count;
+        arena.release(children, count);
+    }
+}
+
+//the smallest first, and the further of two that are as small
+bool Proof::isSmaller(const Candidate& a, const Candidate& b) {
+    return a.size != b.size ? a.size < b.size : a.distance > b.distance;
+}
+
+/**
+ * Collapses the smallest subtrees off the most proving path until the tree is
+ * down to three quarters of the budget. A small subtree is cheap to search again,
+ * while collapsing a large one throws away work that the search would have to
+ * repeat when the subtree becomes most proving again. A node is larger than the
+ * nodes below it, so they are collapsed first. Solved subtrees are freed as soon
+ * as they are solved, so only open ones are left to collect.
+ */
+void Proof::collectGarbage() {
+    collections++;
+    uint64_t target = nodeBudget / 4 * 3;
+    //the search starts again from the root
+    path.resize(1);
+
+    //every expanded node in preorder with the index of its parent, then the sizes from the bottom up
+    std::vector<Candidate> nodes;
+    std::vector<int> parents;
+    std::vector<bool> mostProving;
+    Candidate root;
+    root.distance = 0;
+    root.size = 0;
+    root.node = path[0].node;
+    nodes.push_back(root);
+    parents.push_back(-1);
+    mostProving.push_back(true);
+    for (unsigned int k = 0; k < nodes.size(); k++) {
+        Candidate parent = nodes[k];
+        Node* n = arena.get(parent.node);
+        for (int i = 0; i < n->childrenCount; i++) {
+            Node& c = arena.get(n->children)[i];
+            if (c.childrenCount == 0) continue;
+            Candidate child;
+            child.distance = std::max(parent.distance, n->disjunction ? c.proof - n->proof : c.disproof - n->disproof);
+            child.size = 0;
+            child.node = n->children + i;
+            nodes.push_back(child);
+            parents.push_back(k);
+            mostProving.push_back(mostProving[k] && i == n->best);
+        }
+    }
+    std::vector<Candidate> candidates;
+    for (int k = nodes.size() - 1; k > 0; k--) {
+        nodes[k].size += arena.get(nodes[k].node)->childrenCount;
+        nodes[parents[k]].size += nodes[k].size;
+        if (!mostProving[k]) candidates.push_back(nodes[k]);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), isSmaller);
+    for (unsigned int i = 0; i < candidates.size() && (uint64_t) allocated > target; i++) {
+        Node* n = arena.get(candidates[i].node);
+        freeChildren(n);
+        n->expanded = false;
+        n->collapsed = true;
+    }
+}
+
+/**
+ * A collapsed node that is expanded again gets the numbers of new leaves for its
+ * children, and would look cheap and be chosen again. The children are raised so
+ * that the node keeps at least the numbers it had.
+ */
+void Proof::keepNumbers(Node* n, int proof, int disproof) {
+    n->collapsed = false;
+    if (!n->expanded) return;
+
+    Node* children = arena.get(n->children);
+    //the number of the node that is the least of its children's, and the one that is their sum
+    int least = n->disjunction ? proof : disproof;
+    int total = n->disjunction ? disproof : proof;
+    int sum = 0;
+    Node* open = NULL;
+    for (int i = 0; i < n->childrenCount; i++) {
+        Node& c = children[i];
+        int& minimum = n->disjunction ? c.proof : c.disproof;
+        int& summed = n->disjunction ? c.disproof : c.proof;
+        if (c.proof != 0 && c.disproof != 0) {
+            minimum = std::max(minimum, least);
+            if (open == NULL) open = &c;
+        }
+        sum += summed;
+    }
+    if (open != NULL && sum < total) {
+        (n->disjunction ? open->disproof : open->proof) += total - sum;
+    }
 }
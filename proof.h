@@ -2,52 +2,229 @@
 #ifndef PROOF_H
 #define	PROOF_H
 
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
 #include "game.h"
 #include "handicap.h"
 
 typedef struct Node Node;
 
+/**
+ * 16 bytes. The children are an index into the NodeArena, and the parent is not
+ * stored because the search keeps the path from the root. The most proving child
+ * is kept by setProofNumbers, so the descent does not look for it again.
+ */
 struct Node {
     int proof;
     int disproof;
-    int value;
-    bool disjunction;
-    bool expanded;
+    //the first child in the arena, NO_CHILDREN if there are none
+    uint32_t children;
     char move;
-    Node* parent;
-    Node* children;
-    int childrenCount;
+    unsigned char value : 2;
+    bool disjunction : 1;
+    bool expanded : 1;
+    //a thread is searching the leaf
+    bool busy : 1;
+    unsigned char childrenCount : 5;
+    unsigned char best : 5;
+    //turned into a leaf by the garbage collection, keeps its numbers when expanded again
+    bool collapsed : 1;
+};
+
+const uint32_t NO_CHILDREN = 0;
+
+/**
+ * Allocates the children arrays of proof nodes from large slabs. Freed arrays are
+ * kept in a free list for their size, and since a node has at most MAX_CHILDREN
+ * children there are only a few sizes. The free arrays are linked through the
+ * children of their first node.
+ *
+ * An array is known by the 32-bit index of its first node. The first node of the
+ * first slab is never used, so index 0 is NO_CHILDREN.
+ */
+class NodeArena {
+public:
+    //every move plus the pass of a full board
+    static const int MAX_CHILDREN = 2 * BOARD_WIDTH + 1;
+    static const int SLAB_BITS = 16;
+    static const int SLAB_NODES = 1 << SLAB_BITS;
+
+private:
+    std::vector<Node*> slabs;
+    //the slab being carved and the nodes used from it
+    unsigned int slab;
+    int used;
+    uint32_t freeLists[MAX_CHILDREN + 1];
+    uint64_t freeNodes;
+    uint64_t allocations;
+
+public:
+    NodeArena();
+    ~NodeArena();
+
+    uint32_t allocate(int count);
+    void release(uint32_t nodes, int count);
+
+    //the nodes of an array are in the same slab
+    Node* get(uint32_t index) const {
+        return slabs[index >> SLAB_BITS] + (index & (SLAB_NODES - 1));
+    }
+
+    /**
+     * Frees every array at once, the slabs are kept for the next search
+     */
+    void reset();
+
+    uint64_t getReservedBytes() const {
+        return (uint64_t) slabs.size() * SLAB_NODES * sizeof (Node);
+    }
+
+    int getSlabCount() const {
+        return slabs.size();
+    }
+
+    //nodes waiting in the free lists
+    uint64_t getFreeNodes() const {
+        return freeNodes;
+    }
+
+    uint64_t getAllocations() const {
+        return allocations;
+    }
 };
 
 class Proof : public Game {
     static const int INF = 100000000;
     static const int PROVEN = 1;
     static const int DISPROVEN = 2;
+    //added to the numbers of a leaf while a thread searches it
+    static const int VIRTUAL_NUMBER = 1000;
+
+    //a node on the path from the root and its board, so moves are not played to reach it
+    typedef struct {
+        uint32_t node;
+        bitboard current;
+        bitboard other;
+    } Level;
 
     bool solveRed;
+    //white is solved under the handicap unless asked not to
+    bool handicap;
+    int rootPly;
+    NodeArena arena;
+    //the nodes from the root to the node being searched
+    std::vector<Level> path;
+    //children arrays waiting to be freed and their sizes
+    std::vector<std::pair<uint32_t, int> > freeStack;
+    //evaluates the leaves in PN2 mode
+    Proof* secondLevel;
+
+    //an expanded node the garbage collection may collapse
+    typedef struct {
+        //the furthest any node from the root down to it is from being the most proving
+        int distance;
+        //the nodes below it
+        int size;
+        uint32_t node;
+    } Candidate;
+
+    //what a second level search found out about a leaf
+    typedef struct {
+        int value;
+        int expansions;
+        int count;
+        int proofs[NodeArena::MAX_CHILDREN];
+        int disproofs[NodeArena::MAX_CHILDREN];
+    } LeafResult;
+
+    //the tree is only touched under the lock when several threads search it
+    std::mutex treeLock;
+    std::condition_variable jobDone;
+    int inFlight;
 
 public:
+    static const int DEFAULT_SECOND_LEVEL_LIMIT = 200;
+    //below this the collections do not leave room for the search to go deeper
+    static const uint64_t MIN_NODE_BUDGET = 100000;
+
+    /**
+     * The numbers of new leaves. UNIFORM gives every leaf 1 and 1. MOBILITY gives
+     * the side that has to refute every move of the leaf as many as there are
+     * moves. THREATS adds the immediate wins and the threats on the rows of the
+     * right parity of both players.
+     */
+    enum Initialization {
+        UNIFORM, MOBILITY, THREATS
+    };
+
     int handicapPlyLimit;
     std::function<void() > reportCallback;
+    /**
+     * With a limit each leaf is searched by a second proof-number search of at most
+     * that many expansions before it is expanded (PN2). The numbers of the leaf's
+     * children are taken from that search, and a solved leaf is not expanded.
+     */
+    int secondLevelLimit;
+    /**
+     * When the tree has more nodes than the budget the smallest subtrees off the
+     * most proving path are collapsed into leaves until the tree is down to three
+     * quarters of the budget. 0 means no budget, and smaller budgets than
+     * MIN_NODE_BUDGET are rejected. The search re-expands collapsed subtrees more
+     * often the further the budget is below the size of the tree: on 5x4 white
+     * takes 2.6M expansions and 7.2M nodes without a budget, 4M expansions with
+     * 1M nodes and 28M with 0.1M.
+     */
+    uint64_t nodeBudget;
+    /**
+     * With more than one thread every thread selects a leaf and searches it with
+     * a second level search outside the lock, so PN2 is used even without a
+     * secondLevelLimit.
+     */
+    int threadCount;
+    Initialization initialization;
 
-    Proof() : handicapPlyLimit(Handicap::DEFAULT_PLY_LIMIT) {
+    Proof() : secondLevel(NULL), handicapPlyLimit(Handicap::DEFAULT_PLY_LIMIT), secondLevelLimit(0), nodeBudget(0), threadCount(1),
+    initialization(UNIFORM) {
     }
 
-    int solve(bool white = true);
+    ~Proof() {
+        delete secondLevel;
+    }
+
+    int solve(bool white = true, bool withHandicap = true);
+    //both sides under the full rules
     int exactSolve();
     int expansions;
     int allocated;
+    uint64_t secondLevelExpansions;
+    int collections;
+
+    const NodeArena& getArena() const {
+        return arena;
+    }
 
 private:
-    int evaluateChild(Successor& succ);
+    Node* start(bitboard rootCurrent, bitboard rootOther, int startPly);
+    void run(int expansionLimit);
+    void work();
+    int evaluateChild(Successor& succ, const std::vector<Level>& levels);
     int evaluateChildWithHandicap(Successor& succ);
-    void expand(Node*);
+    void initializeNumbers(Node& n, const Successor& s);
+    void searchLeaf(Proof* search, const std::vector<Level>& levels, int limit, LeafResult& result);
+    void applyLeafResult(Node* leaf, const std::vector<Level>& levels, const LeafResult& result);
+    bool isOnTree(const std::vector<Level>& levels);
+    void expand(Node*, const std::vector<Level>& levels);
     void setProofNumbers(Node*);
-    Node* selectMostProvingNode(Node*);
-    Node* updateAncestors(Node*, Node*);
+    void selectMostProvingNode(std::vector<Level>& levels);
+    void updateAncestors(std::vector<Level>& levels);
 
     void freeChildren(Node* node);
+    void collectGarbage();
+    void keepNumbers(Node* n, int proof, int disproof);
+    static bool isSmaller(const Candidate& a, const Candidate& b);
 
 };
 
@@ -0,0 +1,331 @@
+#include "proofdag.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace Connect4;
+
+const int ProofDag::INF;
+const uint32_t ProofDag::DISPROVEN_NODE;
+const uint32_t ProofDag::PROVEN_NODE;
+const uint16_t ProofDag::NO_DEPENDENCY;
+const int16_t ProofDag::NOT_ON_PATH;
+const int16_t ProofDag::IN_HISTORY;
+
+//the splitmix64 finalizer
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static char mirror(char move) {
+    char first = move >= 'a' ? 'a' : 'A';
+    return first + BOARD_WIDTH - 1 - (move - first);
+}
+
+int ProofDag::solve(bool white, bool withHandicap) {
+    solveRed = !white;
+    handicap = white && withHandicap;
+    bool solverMoves = (ply % 2 == 0) ^ solveRed;
+
+    if (Connect4::hasWon(other)) {
+        return LOSS;
+    }
+    if (Connect4::hasWon(current)) {
+        return WIN;
+    }
+
+    nodes.clear();
+    edges.clear();
+    positions.clear();
+    contexts.clear();
+    DagNode terminal = DagNode();
+    terminal.dependencyLow = terminal.dependencyHigh = NO_DEPENDENCY;
+    terminal.pathDepth = NOT_ON_PATH;
+    terminal.proof = INF;
+    terminal.disproof = 0;
+    nodes.push_back(terminal);
+    terminal.proof = 0;
+    terminal.disproof = INF;
+    nodes.push_back(terminal);
+
+    //moving back to a position of the game so far is a draw on every path
+    if (!handicap) {
+        for (int i = 0; i < ply; i++) {
+            nodes[getNode(getKey(pastPositions[i], i % 2 == 0))].pathDepth = IN_HISTORY;
+        }
+    }
+
+    uint32_t root = getNode(getKey(getPosition(), ply % 2 == 0));
+    expansions = transpositions = 0;
+    path.assign(1, root);
+    stamps.assign(1, mix(root));
+    nodes[root].pathDepth = 0;
+    while (true) {
+        int best = update(path.back());
+        if (best >= 0) {
+            const DagNode& n = nodes[path.back()];
+            const DagEdge& e = edges[n.edges + best];
+            push(e.node, n.flipped != isFlipped() ? mirror(e.move) : e.move);
+            continue;
+        }
+
+        if (!nodes[path.back()].expanded) {
+            expand(path.back());
+            update(path.back());
+        }
+        //the path is updated up to the root, shared nodes may have changed above where the numbers stop changing
+        while (path.size() > 1) {
+            pop();
+            update(path.back());
+        }
+        if (nodes[root].proof == 0 || nodes[root].disproof == 0) break;
+    }
+    nodes[root].pathDepth = NOT_ON_PATH;
+
+    if (nodes[root].proof == 0) {
+        return solverMoves ? WIN : LOSS;
+    }
+    return solverMoves ? DRAW_OR_LOSS : DRAW_OR_WIN;
+}
+
+int ProofDag::exactSolve() {
+    int white = solve(true, false);
+    if ((white & 1) != 0) {
+        return white;
+    }
+
+    int red = solve(false);
+    if ((red & 1) != 0) {
+        return red;
+    }
+    return DRAW;
+}
+
+/**
+ * The position with the player to move in the lowest bit. Under the handicap a
+ * position and its mirror image get the same key.
+ */
+bitboard ProofDag::getKey(bitboard pos, bool whiteMoves) const {
+    if (handicap) {
+        pos = std::min(pos, flip(pos));
+    }
+    return pos << 1 | (whiteMoves ? 1 : 0);
+}
+
+bool ProofDag::isFlipped() const {
+    bitboard pos = getPosition();
+    return handicap && flip(pos) < pos;
+}
+
+uint32_t ProofDag::getNode(bitboard key) {
+    std::unordered_map<bitboard, uint32_t>::const_iterator found = positions.find(key);
+    if (found != positions.end()) {
+        transpositions++;
+        return found->second;
+    }
+
+    DagNode n = DagNode();
+    n.proof = 1;
+    n.disproof = 1;
+    n.dependencyLow = n.dependencyHigh = NO_DEPENDENCY;
+    n.pathDepth = NOT_ON_PATH;
+    nodes.push_back(n);
+    positions[key] = nodes.size() - 1;
+    return nodes.size() - 1;
+}
+
+/**
+ * The same as Proof::evaluateChildWithHandicap under the handicap, otherwise the
+ * repetitions are found when the numbers are updated
+ */
+int ProofDag::evaluateChild(const Successor& s) const {
+    bool whiteMoves = ply % 2 == 0;
+    bool solverMoves = whiteMoves ^ solveRed;
+
+    if (hasWon(s.newOther)) {
+        return solverMoves ? PROVEN : DISPROVEN;
+    }
+    if (s.pop && hasWon(s.newCurrent)) {
+        return solverMoves ? DISPROVEN : PROVEN;
+    }
+    if (handicap) {
+        if (s.pop && whiteMoves) return DISPROVEN;
+        if (ply >= handicapPlyLimit) return DISPROVEN;
+    }
+    return UNKNOWN;
+}
+
+void ProofDag::expand(uint32_t index) {
+    expansions++;
+    if (reportCallback != NULL && expansions % 100000 == 0) {
+        reportCallback();
+    }
+
+    Successor succ[WIDTH * 2];
+    int count = getSuccessors(succ, false);
+    bool childWhite = ply % 2 == 1;
+    uint32_t first = edges.size();
+    for (int i = 0; i < count; i++) {
+        Successor& s = succ[i];
+        DagEdge e;
+        e.move = s.pop ? 'A' + s.column : 'a' + s.column;
+        switch (evaluateChild(s)) {
+            case PROVEN:
+                e.node = PROVEN_NODE;
+                break;
+            case DISPROVEN:
+                e.node = DISPROVEN_NODE;
+                break;
+            default:
+                e.node = getNode(getKey(Connect4::getPosition(s.newCurrent, s.newOther), childWhite));
+        }
+        edges.push_back(e);
+    }
+    //on a full board the player to move may take the draw
+    if ((current | other) == FULL) {
+        DagEdge e;
+        e.node = DISPROVEN_NODE;
+        e.move = '.';
+        edges.push_back(e);
+    }
+
+    DagNode& n = nodes[index];
+    n.edges = first;
+    n.edgeCount = edges.size() - first;
+    n.flipped = isFlipped();
+    n.expanded = true;
+}
+
+/**
+ * Recomputes the numbers of the node at the end of the path from its children as
+ * seen from this path. Children on the path are draws by repetition, and solved
+ * children that depend on another path count as unsearched. Returns the most
+ * proving edge, or -1 if the node is solved or not expanded.
+ */
+int ProofDag::update(uint32_t index) {
+    DagNode& n = nodes[index];
+    if (!n.expanded) return -1;
+    if ((n.proof == 0 || n.disproof == 0) && n.dependencyLow == NO_DEPENDENCY) return -1;
+
+    int depth = path.size() - 1;
+    bool orNode = (ply % 2 == 0) ^ solveRed;
+    int proof = orNode ? INF : 0;
+    int disproof = orNode ? 0 : INF;
+    int best = -1;
+    int bestValue = INF + 1;
+    //the repetitions a disproof depends on, an AND node takes the child that depends on the least
+    uint16_t low = NO_DEPENDENCY;
+    uint16_t high = orNode ? 0 : NO_DEPENDENCY;
+    bool independent = false;
+
+    for (int i = 0; i < n.edgeCount; i++) {
+        const DagNode& c = nodes[edges[n.edges + i].node];
+        int childProof = c.proof;
+        int childDisproof = c.disproof;
+        uint16_t childLow = c.dependencyLow;
+        uint16_t childHigh = c.dependencyHigh;
+        if (c.pathDepth == IN_HISTORY) {
+            childProof = INF;
+            childDisproof = 0;
+            childLow = NO_DEPENDENCY;
+        } else if (c.pathDepth != NOT_ON_PATH) {
+            childProof = INF;
+            childDisproof = 0;
+            childLow = childHigh = c.pathDepth;
+        } else if (childLow != NO_DEPENDENCY && (childHigh > depth || stamps[childHigh] != c.stamp)) {
+            if (!findContext(edges[n.edges + i].node, depth, childLow, childHigh)) {
+                childProof = childDisproof = 1;
+                childLow = NO_DEPENDENCY;
+            }
+        }
+
+        bool solved = childProof == 0 || childDisproof == 0;
+        if (orNode) {
+            proof = std::min(proof, childProof);
+            disproof = std::min(disproof + childDisproof, INF);
+            if (!solved && childProof < bestValue) {
+                bestValue = childProof;
+                best = i;
+            }
+            if (childDisproof == 0 && childLow != NO_DEPENDENCY) {
+                low = std::min(low, childLow);
+                high = std::max(high, childHigh);
+            }
+        } else {
+            proof = std::min(proof + childProof, INF);
+            disproof = std::min(disproof, childDisproof);
+            if (!solved && childDisproof < bestValue) {
+                bestValue = childDisproof;
+                best = i;
+            }
+            if (childDisproof == 0) {
+                if (childLow == NO_DEPENDENCY) {
+                    independent = true;
+                } else if (childHigh < high) {
+                    low = childLow;
+                    high = childHigh;
+                }
+            }
+        }
+    }
+
+    //repetitions of this node hold on every path to it
+    if (disproof != 0 || independent || low >= depth) {
+        low = high = NO_DEPENDENCY;
+    } else {
+        high = std::min<int>(high, depth - 1);
+    }
+    uint64_t stamp = low == NO_DEPENDENCY ? 0 : stamps[high];
+    if (n.disproof == 0 && n.dependencyLow != NO_DEPENDENCY
+            && (low == NO_DEPENDENCY || n.dependencyHigh != high || n.stamp != stamp)) {
+        saveContext(index);
+    }
+    n.proof = proof;
+    n.disproof = disproof;
+    n.dependencyLow = low;
+    n.dependencyHigh = high;
+    n.stamp = stamp;
+    return proof == 0 || disproof == 0 ? -1 : best;
+}
+
+void ProofDag::saveContext(uint32_t index) {
+    const DagNode& n = nodes[index];
+    DagContext context;
+    context.node = index;
+    context.dependencyLow = n.dependencyLow;
+    context.dependencyHigh = n.dependencyHigh;
+    contexts[n.stamp ^ mix(index)] = context;
+}
+
+/**
+ * Looks for a disproof the node kept for a path that is the same as this one down
+ * to its deepest repeated position. The child of the node at depth is below it.
+ */
+bool ProofDag::findContext(uint32_t index, int depth, uint16_t& low, uint16_t& high) const {
+    uint64_t key = mix(index);
+    for (int i = 0; i <= depth; i++) {
+        std::unordered_map<uint64_t, DagContext>::const_iterator found = contexts.find(stamps[i] ^ key);
+        if (found != contexts.end() && found->second.node == index && found->second.dependencyHigh == i) {
+            low = found->second.dependencyLow;
+            high = found->second.dependencyHigh;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ProofDag::push(uint32_t index, char move) {
+    play(move);
+    path.push_back(index);
+    stamps.push_back(mix(stamps.back() ^ index));
+    assert(path.size() < 0x7FFF);
+    nodes[index].pathDepth = path.size() - 1;
+}
+
+void ProofDag::pop() {
+    nodes[path.back()].pathDepth = NOT_ON_PATH;
+    path.pop_back();
+    stamps.pop_back();
+    undo();
+}
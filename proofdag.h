@@ -0,0 +1,135 @@
+#ifndef PROOFDAG_H
+#define	PROOFDAG_H
+
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "game.h"
+#include "handicap.h"
+
+/**
+ * A proof-number node shared by every path that reaches its position. Solved
+ * nodes whose disproof relies on a repetition of a position above them remember
+ * the part of the path it was found on.
+ */
+struct DagNode {
+    int proof;
+    int disproof;
+    //the first edge of the node
+    uint32_t edges;
+    unsigned char edgeCount;
+    bool expanded : 1;
+    //the edges were made from the mirrored position
+    bool flipped : 1;
+    //the shallowest and deepest repeated positions on the path, NO_DEPENDENCY if none
+    uint16_t dependencyLow;
+    uint16_t dependencyHigh;
+    //the depth of the node on the current path, or NOT_ON_PATH or IN_HISTORY
+    int16_t pathDepth;
+    //the hash of the path down to dependencyHigh
+    uint64_t stamp;
+};
+
+typedef struct {
+    uint32_t node;
+    char move;
+} DagEdge;
+
+//a disproof of a node that depends on the path, kept when the node is solved again for another path
+typedef struct {
+    uint32_t node;
+    uint16_t dependencyLow;
+    uint16_t dependencyHigh;
+} DagContext;
+
+/**
+ * Proof-number search over a graph of positions. Proof expands every move order
+ * separately, here a position reached again is looked up and its node is shared,
+ * so it is expanded once. The numbers of a node are recomputed from its children
+ * when the search passes through it, and are updated along the path it came by.
+ *
+ * White is solved under the handicap like Proof does unless asked not to. White
+ * never pops there, so positions cannot repeat and mirrored positions share a node
+ * too. Otherwise the full rules are played, where a repeated position is a draw. Whether a node is a
+ * draw by repetition depends on the path it is reached by (the graph-history
+ * interaction problem). Proofs never rely on a repetition, so they hold on every
+ * path. A disproof that does is kept with the hash of the path down to the
+ * deepest repeated position, and is only trusted when the node is reached with
+ * the same path above it. Otherwise the node is searched again, and the disproof
+ * it had is kept aside by that hash, so paths that take turns through a node do
+ * not solve it over and over for each other.
+ */
+class ProofDag : public Game {
+    static const int INF = 100000000;
+    static const int PROVEN = 1;
+    static const int DISPROVEN = 2;
+
+    //the children every terminal move points to
+    static const uint32_t DISPROVEN_NODE = 0;
+    static const uint32_t PROVEN_NODE = 1;
+
+    static const uint16_t NO_DEPENDENCY = 0xFFFF;
+    static const int16_t NOT_ON_PATH = -1;
+    static const int16_t IN_HISTORY = -2;
+
+    bool solveRed;
+    bool handicap;
+    std::vector<DagNode> nodes;
+    std::vector<DagEdge> edges;
+    std::unordered_map<bitboard, uint32_t> positions;
+    //the nodes from the root to the node being searched, and the hashes of the path to them
+    std::vector<uint32_t> path;
+    std::vector<uint64_t> stamps;
+    //the disproofs nodes had for other paths, by the hash of the path and the node
+    std::unordered_map<uint64_t, DagContext> contexts;
+
+public:
+    int handicapPlyLimit;
+    std::function<void() > reportCallback;
+
+    uint64_t expansions;
+    //children found in the graph instead of being added
+    uint64_t transpositions;
+
+    ProofDag() : handicapPlyLimit(Handicap::DEFAULT_PLY_LIMIT) {
+    }
+
+    int solve(bool white = true, bool withHandicap = true);
+    //both sides under the full rules
+    int exactSolve();
+
+    uint64_t getNodeCount() const {
+        return nodes.size();
+    }
+
+    uint64_t getEdgeCount() const {
+        return edges.size();
+    }
+
+    /**
+     * The nodes, the edges and the position map. A map entry is counted as its
+     * key and value plus a next pointer, as the standard library allocates it.
+     */
+    uint64_t getBytes() const {
+        uint64_t entry = sizeof (std::pair<const bitboard, uint32_t>) + sizeof (void*);
+        return nodes.capacity() * sizeof (DagNode) + edges.capacity() * sizeof (DagEdge)
+                + positions.bucket_count() * sizeof (void*) + positions.size() * entry
+                + contexts.bucket_count() * sizeof (void*)
+                + contexts.size() * (sizeof (std::pair<const uint64_t, DagContext>) + sizeof (void*));
+    }
+
+private:
+    bitboard getKey(bitboard pos, bool whiteMoves) const;
+    uint32_t getNode(bitboard key);
+    int evaluateChild(const Successor& s) const;
+    void expand(uint32_t index);
+    bool isFlipped() const;
+    int update(uint32_t index);
+    void saveContext(uint32_t index);
+    bool findContext(uint32_t index, int depth, uint16_t& low, uint16_t& high) const;
+    void push(uint32_t index, char move);
+    void pop();
+};
+
+#endif
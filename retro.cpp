@@ -1,185 +1,405 @@
 #include "retro.h"
+#include "retrodb.h"
+#include <algorithm>
 #include <iostream>
 #include <queue>
 #include <new>
 #include <cassert>
+#include <thread>
 
 using namespace Connect4;
 
-bitboard parentPos;
+RetroChunkPool::~RetroChunkPool() {
+    trim();
+}
+
+bitboard* RetroChunkPool::acquire() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!chunks.empty()) {
+            bitboard* chunk = chunks.back();
+            chunks.pop_back();
+            return chunk;
+        }
+    }
+    return new bitboard[RETRO_CHUNK_SIZE];
+}
+
+void RetroChunkPool::release(bitboard* chunk) {
+    std::lock_guard<std::mutex> guard(lock);
+    chunks.push_back(chunk);
+}
 
-Retro::Retro() {
-    tableSize = (uint64_t) 1 << (WIDTH * (HEIGHT + 1));
-    states = new byte[tableSize];
+void RetroChunkPool::trim() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (unsigned int i = 0; i < chunks.size(); i++) {
+        delete[] chunks[i];
+    }
+    std::vector<bitboard*>().swap(chunks);
+}
+
+RetroList::RetroList(RetroList&& list) : pool(list.pool), count(list.count) {
+    chunks.swap(list.chunks);
+    list.count = 0;
+}
+
+RetroList::~RetroList() {
+    clear();
+}
+
+void RetroList::append(RetroList& list) {
+    for (unsigned int i = 0; i < list.chunks.size(); i++) {
+        if (list.chunks[i].size > 0) {
+            chunks.push_back(list.chunks[i]);
+        } else {
+            pool->release(list.chunks[i].positions);
+        }
+    }
+    count += list.count;
+    list.chunks.clear();
+    list.count = 0;
+}
+
+void RetroList::swap(RetroList& list) {
+    std::swap(pool, list.pool);
+    chunks.swap(list.chunks);
+    std::swap(count, list.count);
+}
+
+void RetroList::clear() {
+    for (unsigned int i = 0; i < chunks.size(); i++) {
+        pool->release(chunks[i].positions);
+    }
+    chunks.clear();
+    count = 0;
+}
+
+Retro::Retro(int threads) : results(NULL), stateCount(0), terminals(&pool), threadCount(threads) {
+    if (threadCount <= 0) threadCount = std::thread::hardware_concurrency();
+    if (threadCount <= 0) threadCount = 1;
+    tableSize = index.getSize();
+    states = new std::atomic<byte>[tableSize];
 
     try {
         initStates();
         processTerminals();
+        pack();
     } catch (std::bad_alloc& ba) {
         std::cerr << "bad_alloc: " << ba.what() << std::endl;
         std::cout << "States generated: " << stateCount << std::endl;
         exit(1);
     }
 
-    byte rootScore = states[Connect4::getPosition(0, 0)];
-    if ((rootScore & FINISHED) == 0) {
+    int rootScore = getScore(Connect4::getPosition(0, 0));
+    if (rootScore == UNKNOWN) {
         std::cout << "Root score: Draw by repeat" << std::endl;
     } else {
-        std::cout << "Root score: " << scoreToString(rootScore & SCORE_MASK) << std::endl;
+        std::cout << "Root score: " << scoreToString(rootScore) << std::endl;
     }
     
 }
 
 Retro::~Retro() {
     delete[] states;
+    delete[] results;
 }
 
-void Retro::initStates() {
-    memset(states, 0, tableSize * sizeof (byte));
-    for (unsigned int i = 0; i < tableSize; i++) {
-        states[i] = UNINITIALIZED;
+void Retro::save(const std::string& file, int maxPieces) {
+    SliceIndex slices;
+    RetroDb::save(file, maxPieces, [this, &slices](int slice, std::vector<byte>& scores) {
+        for (uint64_t i = 0; i < scores.size(); i++) {
+            scores[i] = getScore(slices.unrank(slice, i));
+        }
+    });
+}
+
+/**
+ * Replaces the state bytes with the packed results. Positions that were not
+ * resolved are draws by repetition or unreachable, both are left unknown.
+ */
+void Retro::pack() {
+    uint64_t bytes = (tableSize + RESULTS_PER_BYTE - 1) / RESULTS_PER_BYTE;
+    results = new byte[bytes];
+
+    //every thread fills whole bytes
+    auto work = [this, bytes](uint64_t begin, uint64_t end) {
+        for (uint64_t b = begin; b < end; b++) {
+            byte packed = 0;
+            for (int j = 0; j < RESULTS_PER_BYTE; j++) {
+                uint64_t i = b * RESULTS_PER_BYTE + j;
+                if (i >= tableSize) break;
+                byte state = states[i].load(std::memory_order_relaxed);
+                if ((state & FINISHED) != 0) {
+                    packed |= ((state & SCORE_MASK) + 1) / 2 << (j * RESULT_BITS);
+                }
+            }
+            results[b] = packed;
+        }
+    };
+    std::vector<std::thread> workers;
+    uint64_t chunk = (bytes + threadCount - 1) / threadCount;
+    for (uint64_t begin = chunk; begin < bytes; begin += chunk) {
+        workers.push_back(std::thread(work, begin, std::min(begin + chunk, bytes)));
+    }
+    work(0, std::min(chunk, bytes));
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    delete[] states;
+    states = NULL;
+}
+
+/**
+ * Calls visit for every position of the list. The threads take a chunk at a time
+ * and their outputs are appended to the result after all of them are done.
+ *
+ * The positions a thread adds to its next list are visited right away, depth first
+ * while the positions around them are still in the cache. Each position of the list
+ * may lead to LOCAL_WORK visits like this, what is left is visited in the next wave.
+ */
+template<typename Visit>
+void Retro::forEachNode(const RetroList& list, Visit visit, RetroOutput& result) {
+    int threads = std::min(threadCount, list.getChunkCount());
+    std::vector<RetroOutput> outputs;
+    outputs.reserve(std::max(threads, 1));
+    for (int i = 0; i < std::max(threads, 1); i++) {
+        outputs.emplace_back(&pool);
+    }
+    std::atomic<int> next(0);
+    auto work = [&](RetroOutput& out) {
+        int c;
+        while ((c = next++) < list.getChunkCount()) {
+            int size;
+            const bitboard* positions = list.getChunk(c, size);
+            for (int i = 0; i < size; i++) {
+                visit(positions[i], out);
+                int visited = 1;
+                while (!out.next.empty() && visited < LOCAL_WORK) {
+                    visit(out.next.pop_back(), out);
+                    visited++;
+                }
+                out.visited += visited;
+            }
+        }
+    };
+
+    if (threads <= 1) {
+        work(outputs[0]);
+    } else {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::thread(work, std::ref(outputs[i])));
+        }
+        for (int i = 0; i < threads; i++) {
+            workers[i].join();
+        }
     }
 
+    for (unsigned int i = 0; i < outputs.size(); i++) {
+        result.next.append(outputs[i].next);
+        result.pops.append(outputs[i].pops);
+        result.terminals.append(outputs[i].terminals);
+        result.visited += outputs[i].visited;
+    }
+}
+
+void Retro::initStates() {
+    memset((void*) states, UNINITIALIZED, tableSize * sizeof (byte));
+
     stateCount = 0;
-    List dropList;
-    dropList.reserve(1000000);
-    List popList;
+    RetroList dropList(&pool);
+    RetroList popList(&pool);
 
-    RetroNode root;
-    root.current = 0;
-    root.other = 0;
+    bitboard root = Connect4::getPosition(0, 0);
     dropList.push_back(root);
-    states[Connect4::getPosition(root.current, root.other)] = 0;
+    getState(root) = 0;
   
-    process(dropList, popList);
+    process(dropList, popList, false);
     std::cout << "Drop states: " << stateCount << std::endl;
     assert(dropList.empty());
-    List(dropList).swap(dropList);
 
-    process(popList, popList);
+    process(popList, popList, true);
     std::cout << "Pop states: " << stateCount << std::endl;
     assert(popList.empty());
+    pool.trim();
 }
 
-void Retro::process(List& mainList, List& popList) {
-    using namespace Connect4;
+/**
+ * Marks a position as reached. Returns false if it was reached before.
+ */
+bool Retro::claim(bitboard pos) {
+    std::atomic<byte>& state = getState(pos);
+    byte expected = UNINITIALIZED;
+    //most positions are reached many times, a plain load is cheaper than a failed swap
+    if (state.load(std::memory_order_relaxed) != expected) return false;
+    if (threadCount == 1) {
+        state.store(0, std::memory_order_relaxed);
+        return true;
+    }
+    return state.compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+}
 
+/**
+ * Visits the main list wave by wave. Positions reached by popping go to the pop
+ * list, or back to the main list if popsToMain is set. The list of a wave is
+ * cleared before the next one is visited, so its chunks are used again.
+ */
+void Retro::process(RetroList& mainList, RetroList& popList, bool popsToMain) {
     while (!mainList.empty()) {
-        RetroNode currentNode = mainList.back();
-        bitboard currentPosition = parentPos = getPosition(currentNode.current, currentNode.other);
-        mainList.pop_back();
-        stateCount++;
-
-        if (hasWon(currentNode.other)) {
-            states[currentPosition] = FINISHED | LOSS;
-            terminals.push_back(currentNode);
-            continue;
-        } else if (hasWon(currentNode.current)) {
-            states[currentPosition] = FINISHED | WIN;
-            terminals.push_back(currentNode);
-            continue;
-        }
-        for (int x = 0; x < WIDTH; x++) {
-            RetroNode node = currentNode;
-            if (drop(node.current, node.other, x)) {
-                bitboard pos = getPosition(node.current, node.other);
-                if (states[pos] == UNINITIALIZED) {
-                    states[pos] = 0;
-                    mainList.push_back(node);
-                }
-                states[currentPosition]++;
+        RetroOutput result(&pool);
+        forEachNode(mainList, [this, popsToMain](bitboard pos, RetroOutput& out) {
+            expand(pos, out, popsToMain);
+        }, result);
+
+        stateCount += result.visited;
+        mainList.clear();
+        mainList.swap(result.next);
+        (popsToMain ? mainList : popList).append(result.pops);
+        terminals.append(result.terminals);
+    }
+}
+
+/**
+ * Finds the successors of a position, and stores how many there are as the number
+ * of children that are still unresolved
+ */
+void Retro::expand(bitboard pos, RetroOutput& out, bool popsToMain) {
+    using namespace Connect4;
+
+    bitboard current, other;
+    splitPosition(pos, current, other);
+    //the worklists hold canonical positions
+    std::atomic<byte>& state = states[index.rank(pos)];
+    if (hasWon(other)) {
+        state.store(FINISHED | LOSS, std::memory_order_relaxed);
+        out.terminals.push_back(pos);
+        return;
+    } else if (hasWon(current)) {
+        state.store(FINISHED | WIN, std::memory_order_relaxed);
+        out.terminals.push_back(pos);
+        return;
+    }
+
+    byte children = 0;
+    for (int x = 0; x < WIDTH; x++) {
+        bitboard c = current, o = other;
+        if (drop(c, o, x)) {
+            bitboard child = getPosition(c, o);
+            if (claim(child)) {
+                out.next.push_back(RetroIndex::normalize(child));
             }
+            children++;
+        }
 #if POPOUT_ON
-            node = currentNode;
-            if (pop(node.current, node.other, x)) {
-                bitboard pos = getPosition(node.current, node.other);
-                if (states[pos] == UNINITIALIZED) {
-                    states[pos] = 0;
-                    popList.push_back(node);
-                }
-                states[currentPosition]++;
+        c = current;
+        o = other;
+        if (pop(c, o, x)) {
+            bitboard child = getPosition(c, o);
+            if (claim(child)) {
+                (popsToMain ? out.next : out.pops).push_back(RetroIndex::normalize(child));
             }
-#endif
+            children++;
         }
-        //check for full board
-        if ((currentNode.current | currentNode.other) == FULL) {
-            if (states[currentPosition] == 0) {
-                states[currentPosition] = FINISHED | DRAW;
-                terminals.push_back(currentNode);
-            } else {
-                states[currentPosition] |= HAS_DRAW;
-            }
+#endif
+    }
+    //check for full board
+    if ((current | other) == FULL) {
+        if (children == 0) {
+            children = FINISHED | DRAW;
+            out.terminals.push_back(pos);
+        } else {
+            children |= HAS_DRAW;
         }
     }
+    state.store(children, std::memory_order_relaxed);
 }
 
-void Retro::updateParent(byte childScore, bitboard current, bitboard other) {
+void Retro::updateParents(byte score, bitboard current, bitboard other, RetroOutput& out) {
     using namespace Connect4;
-    bitboard pos = getPosition(current, other);
-    if (pos > Connect4::ALL1) {
-        std::cout << Connect4::toString(parentPos) << std::endl;
-        std::cout << parentPos << std::endl;
-        std::cout << Connect4::toString(pos);
-        assert(pos <= ALL1);
-    }
-    if ((states[pos] & UNINITIALIZED) != 0) return;
-    if ((states[pos] & FINISHED) != 0) return;
-
-    if (childScore == LOSS) {
-        states[pos] = FINISHED | WIN;
-        RetroNode n;
-        n.current = current;
-        n.other = other;
-        terminals.push_back(n);
-        //confirmValue(n);
-        return;
-    }
 
-    if (childScore == DRAW) {
-        states[pos] |= HAS_DRAW;
+    for (int x = 0; x < WIDTH; x++) {
+        bitboard c = current, o = other;
+        if (undrop(c, o, x)) {
+            updateParent(score, c, o, out);
+        }
+
+#if POPOUT_ON
+        c = current;
+        o = other;
+        if (unpop(c, o, x)) {
+            updateParent(score, c, o, out);
+        }
+#endif
     }
+}
+
+void Retro::updateParent(byte childScore, bitboard current, bitboard other, RetroOutput& out) {
+    using namespace Connect4;
+    bitboard pos = getPosition(current, other);
+    assert(pos <= ALL1);
+    //the mirror image is updated through the mirrored move
+    if (!RetroIndex::isCanonical(pos)) return;
 
-    assert((states[pos] & SCORE_MASK) > 0);
-    states[pos]--;
+    //other threads may be resolving children of the same parent
+    std::atomic<byte>& parent = states[index.rank(pos)];
+    byte state = parent.load(std::memory_order_relaxed);
+    byte updated;
+    do {
+        if ((state & UNINITIALIZED) != 0) return;
+        if ((state & FINISHED) != 0) return;
 
-    if ((states[pos] & SCORE_MASK) == 0) {
-        if ((states[pos] & HAS_DRAW) != 0) {
-            states[pos] = FINISHED | DRAW;
+        if (childScore == LOSS) {
+            updated = FINISHED | WIN;
         } else {
-            states[pos] = FINISHED | LOSS;
+            updated = state;
+            if (childScore == DRAW) {
+                updated |= HAS_DRAW;
+            }
+            assert((updated & SCORE_MASK) > 0);
+            updated--;
+
+            if ((updated & SCORE_MASK) == 0) {
+                updated = FINISHED | ((updated & HAS_DRAW) != 0 ? DRAW : LOSS);
+            }
+        }
+        if (threadCount == 1) {
+            parent.store(updated, std::memory_order_relaxed);
+            break;
         }
-        RetroNode n;
-        n.current = current;
-        n.other = other;
-        terminals.push_back(n);
-        //confirmValue(n);
+    } while (!parent.compare_exchange_weak(state, updated, std::memory_order_relaxed));
+
+    if ((updated & FINISHED) != 0) {
+        out.next.push_back(pos);
     }
 }
 
+/**
+ * Resolves the parents of the terminal positions, then the parents of those that
+ * were resolved in turn, until nothing changes
+ */
 void Retro::processTerminals() {
     using namespace Connect4;
 
     while (!terminals.empty()) {
-        RetroNode currentNode = terminals.back();
-        terminals.pop_back();
-        bitboard currentPosition = parentPos = getPosition(currentNode.current, currentNode.other);
+        RetroOutput result(&pool);
+        forEachNode(terminals, [this](bitboard pos, RetroOutput& out) {
+            byte score = states[index.rank(pos)].load(std::memory_order_relaxed) & SCORE_MASK;
+            bitboard current, other;
+            splitPosition(pos, current, other);
+            updateParents(score, current, other, out);
 
-        byte score = states[currentPosition] & SCORE_MASK;
-
-        for (int x = 0; x < WIDTH; x++) {
-            RetroNode node = currentNode;
-            if (undrop(node.current, node.other, x)) {
-                updateParent(score, node.current, node.other);
-            }
-
-#if POPOUT_ON
-            node = currentNode;
-            if (unpop(node.current, node.other, x)) {
-                updateParent(score, node.current, node.other);
+            //a parent may reach this position only as its mirror image
+            bitboard mirrored = RetroIndex::mirror(pos);
+            if (mirrored != pos) {
+                splitPosition(mirrored, current, other);
+                updateParents(score, current, other, out);
             }
-#endif
-        }
+        }, result);
+        terminals.clear();
+        terminals.swap(result.next);
     }
+    pool.trim();
 }
 
 void Retro::confirmValue(RetroNode node) {
@@ -199,7 +419,7 @@ void Retro::confirmValue(RetroNode node) {
         return;
     }
 
-    if((states[getPosition(node.current, node.other)] & FINISHED) == 0) return;
+    if((getState(getPosition(node.current, node.other)) & FINISHED) == 0) return;
     
     if (parentScore == WIN) {
         bool hasLosing = false;
@@ -254,7 +474,7 @@ void Retro::confirmValue(RetroNode node) {
 
 
 void Retro::confirmTree(RetroNode rootNode) {
-    List list;
+    std::vector<RetroNode> list;
     list.push_back(rootNode);
     while (!list.empty()) {
         RetroNode node = list.back();
@@ -279,8 +499,9 @@ void Retro::confirmTree(RetroNode rootNode) {
 }
 
 void Retro::printUnreachable() {
-	for(bitboard pos = BOTTOM; pos < tableSize; pos++) {
-		if(states[pos] !=	UNINITIALIZED) continue;
+	if(states == NULL) return;
+	for(uint64_t i = 0; i < tableSize; i++) {
+		if(states[i] !=	UNINITIALIZED) continue;
 
 	}
 }
@@ -1,21 +1,134 @@
 #ifndef RETRO_H
 #define	RETRO_H
 
+#include <atomic>
 #include <deque>
+#include <mutex>
 #include <vector>
 #include <cstring>
+#include <string>
 #include "connect4.h"
+#include "retroindex.h"
 
 typedef struct {
     bitboard current;
     bitboard other;
 } RetroNode;
 
-typedef std::vector<RetroNode> List;
-
 typedef unsigned char byte;
 
+//positions in a worklist chunk, a thread claims a whole chunk at a time
+const int RETRO_CHUNK_SIZE = 4096;
+
+/**
+ * Worklist chunks that are reused from one wave to the next
+ */
+class RetroChunkPool {
+    std::mutex lock;
+    std::vector<bitboard*> chunks;
+
+public:
+    ~RetroChunkPool();
+
+    bitboard* acquire();
+    void release(bitboard* chunk);
+    //frees the chunks that are not in use
+    void trim();
+};
+
+/**
+ * A worklist of positions, 8 bytes each, in chunks from a pool. Appending a list
+ * moves its chunks over without copying, so the chunks need not be full.
+ */
+class RetroList {
+    typedef struct {
+        bitboard* positions;
+        int size;
+    } Chunk;
+
+    RetroChunkPool* pool;
+    std::vector<Chunk> chunks;
+    uint64_t count;
+
+public:
+    RetroList(RetroChunkPool* pool) : pool(pool), count(0) {
+    }
+    RetroList(RetroList&& list);
+    ~RetroList();
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    uint64_t size() const {
+        return count;
+    }
+
+    int getChunkCount() const {
+        return chunks.size();
+    }
+
+    const bitboard* getChunk(int i, int& size) const {
+        size = chunks[i].size;
+        return chunks[i].positions;
+    }
+
+    void push_back(bitboard pos) {
+        if (chunks.empty() || chunks.back().size == RETRO_CHUNK_SIZE) {
+            Chunk chunk = {pool->acquire(), 0};
+            chunks.push_back(chunk);
+        }
+        Chunk& last = chunks.back();
+        last.positions[last.size++] = pos;
+        count++;
+    }
+
+    /**
+     * An emptied chunk is kept until the next pop so that pushes and pops at
+     * a chunk boundary do not go to the pool every time
+     */
+    bitboard pop_back() {
+        if (chunks.back().size == 0) {
+            pool->release(chunks.back().positions);
+            chunks.pop_back();
+        }
+        count--;
+        Chunk& last = chunks.back();
+        return last.positions[--last.size];
+    }
+
+    void append(RetroList& list);
+    void swap(RetroList& list);
+    void clear();
+};
+
+//what a thread produces while visiting its part of a worklist
+struct RetroOutput {
+    RetroList next;
+    RetroList pops;
+    RetroList terminals;
+    uint64_t visited;
 
+    RetroOutput(RetroChunkPool* pool) : next(pool), pops(pool), terminals(pool), visited(0) {
+    }
+};
+
+/**
+ * Solves every reachable position by retrograde analysis. The positions are first
+ * enumerated and then resolved backwards from the terminal positions, one wave at a
+ * time. Within a wave the threads claim chunks of the worklist and collect new nodes
+ * in lists of their own, and the state bytes are updated with atomic compare-and-swap,
+ * so the result does not depend on the number of threads.
+ *
+ * Only canonical positions are kept, a position and its mirror image share one state
+ * byte at their RetroIndex. The worklists hold canonical positions, so a resolved
+ * position updates its parents through the retro moves of both itself and its mirror
+ * image.
+ *
+ * While the analysis runs every state is a byte with flags and the number of
+ * children that are still unresolved. When it is done the scores are packed into
+ * RESULT_BITS per state and the bytes are released.
+ */
 class Retro {
     static const int WIDTH = BOARD_WIDTH;
     static const int HEIGHT = BOARD_HEIGHT;
@@ -25,34 +138,70 @@ class Retro {
     static const byte HAS_DRAW = 32;
     static const byte SCORE_MASK = 15;
 
+    //packed results are 0 for unknown, then LOSS, DRAW and WIN
+    static const int RESULT_BITS = 2;
+    static const int RESULTS_PER_BYTE = 8 / RESULT_BITS;
+
+    //visits a thread may do from one node before leaving new nodes to the next wave
+    static const int LOCAL_WORK = 1 << 20;
+
+    RetroIndex index;
     uint64_t tableSize;
-    byte* states;
-    int stateCount;
-    List terminals;
+    std::atomic<byte>* states;
+    byte* results;
+    uint64_t stateCount;
+    RetroChunkPool pool;
+    RetroList terminals;
+    int threadCount;
 
 public:
-    Retro();
+    /**
+     * Uses one thread per core if the thread count is 0
+     */
+    Retro(int threadCount = 0);
     ~Retro();
 
-    int getStateCount() {
+    uint64_t getStateCount() {
         return stateCount;
     }
 
     int getScore(bitboard pos) {
-        if((states[pos] & FINISHED) == 0) return Connect4::UNKNOWN;
-        return states[pos] & SCORE_MASK;
+        uint64_t i = index.rankAny(pos);
+        if (results != NULL) {
+            int code = (results[i / RESULTS_PER_BYTE] >> (i % RESULTS_PER_BYTE * RESULT_BITS)) & 3;
+            return code == 0 ? Connect4::UNKNOWN : code * 2 - 1;
+        }
+        byte state = states[i].load(std::memory_order_relaxed);
+        if((state & FINISHED) == 0) return Connect4::UNKNOWN;
+        return state & SCORE_MASK;
     }
     
     int getScore(RetroNode node) {
         return getScore(Connect4::getPosition(node.current, node.other));
     }
     
+    /**
+     * Writes the results of the positions with at most maxPieces pieces to a
+     * database that RetroDb loads
+     */
+    void save(const std::string& file, int maxPieces = WIDTH * HEIGHT);
+
     void initStates();
 		void printUnreachable();
 private:
-    void process(List& mainList, List& popList);
+    std::atomic<byte>& getState(bitboard pos) {
+        return states[index.rankAny(pos)];
+    }
+
+    template<typename Visit>
+    void forEachNode(const RetroList& list, Visit visit, RetroOutput& result);
+    void process(RetroList& mainList, RetroList& popList, bool popsToMain);
+    void expand(bitboard pos, RetroOutput& out, bool popsToMain);
     void processTerminals();
-    void updateParent(byte score, bitboard, bitboard);
+    void pack();
+    void updateParents(byte score, bitboard current, bitboard other, RetroOutput& out);
+    void updateParent(byte score, bitboard, bitboard, RetroOutput& out);
+    bool claim(bitboard pos);
     void confirmValue(RetroNode);
     void confirmTree(RetroNode);
 };
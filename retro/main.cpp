@@ -1,26 +1,74 @@
 #include "connect4.h"
 #include "retro.h"
+#include "retrodisk.h"
 #include "game.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <ctime>
+#include <stdexcept>
 
 using namespace std;
 using namespace Connect4;
 
-int main() {
+int main(int argc, char *argv[]) {
+	//-d keeps the states in files in the directory, and continues an earlier run there,
+	//memory is then about 512 MB whatever the size of the board
+	string directory;
+	//-o saves the results to a database
+	string output;
+	int threads = 0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			directory = argv[++i];
+		} else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else {
+			threads = atoi(argv[i]);
+		}
+	}
+
 	std::cout << "Solving " << BOARD_WIDTH << "x" << BOARD_HEIGHT << " by retrograde analysis" << std::endl;
-	clock_t begin, end;
-	begin = clock();
-	Retro retro;
-	end = clock();
-	double duration = (double) (end - begin) / CLOCKS_PER_SEC;
+	//wall clock, the analysis runs on several threads
+	auto begin = std::chrono::steady_clock::now();
+	Retro* retro = NULL;
+	RetroDisk* disk = NULL;
+	try {
+		if(directory.empty()) {
+			retro = new Retro(threads);
+		} else {
+			disk = new RetroDisk(directory);
+			disk->solve();
+			cout << "Sweeps: " << disk->getSweeps() << endl;
+		}
+	} catch(const std::runtime_error& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+	auto end = std::chrono::steady_clock::now();
+	double duration = std::chrono::duration<double>(end - begin).count();
 	cout << "Duration: " << duration << " seconds" << endl;
 	Game game;
 	for(int i = 0; i < BOARD_WIDTH; i++) {
 		game.drop(i);
-		std::cout << (char) ('a' + i) << "=" << retro.getScore(game.getPosition()) << " ";
+		int score = retro != NULL ? retro->getScore(game.getPosition()) : disk->getScore(game.getPosition());
+		std::cout << (char) ('a' + i) << "=" << score << " ";
 		game.undo();
 	}
 	cout << endl;
+	if(!output.empty()) {
+		try {
+			if(retro != NULL) {
+				retro->save(output);
+			} else {
+				disk->save(output);
+			}
+			cout << "Saved " << output << endl;
+		} catch(const std::runtime_error& e) {
+			cerr << e.what() << endl;
+		}
+	}
+	delete retro;
+	delete disk;
 	system("pause");
 }
@@ -0,0 +1,142 @@
+#include "retrodb.h"
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char DB_MAGIC[8] = "C4RETDB";
+const uint32_t DB_VERSION = 1;
+//the header is padded to a page so the slices start page aligned
+const uint64_t DB_HEADER_SIZE = 4096;
+const int MAX_SLICES = 64;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t popout;
+    uint32_t resultBits;
+    uint32_t maxPieces;
+    //from the start of the file, 0 for slices that are not in the database
+    uint64_t offsets[MAX_SLICES];
+    uint64_t bytes[MAX_SLICES];
+} DbHeader;
+
+static uint64_t packedBytes(uint64_t positions) {
+    return (positions + 3) / 4;
+}
+
+RetroDb::RetroDb(const std::string& file) : memory(NULL), mappedBytes(0), maxPieces(-1) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    DbHeader header;
+    if (!in.read((char*) &header, sizeof (header))) {
+        throw std::runtime_error("Cannot read retrograde database " + file);
+    }
+    if (memcmp(header.magic, DB_MAGIC, sizeof (DB_MAGIC)) != 0 || header.version != DB_VERSION || header.resultBits != 2) {
+        throw std::runtime_error("Not a retrograde database: " + file);
+    }
+    if (header.width != BOARD_WIDTH || header.height != BOARD_HEIGHT || header.popout != POPOUT_ON) {
+        throw std::runtime_error("The database was made for another game variant: " + file);
+    }
+    if (header.maxPieces >= (uint32_t) SLICES) {
+        throw std::runtime_error("Corrupt retrograde database " + file);
+    }
+
+    uint64_t size = DB_HEADER_SIZE;
+    for (uint32_t i = 0; i <= header.maxPieces; i++) {
+        if (header.offsets[i] != size || header.bytes[i] != packedBytes(index.getSliceSize(i))) {
+            throw std::runtime_error("Corrupt retrograde database " + file);
+        }
+        size += header.bytes[i];
+    }
+
+#ifdef __linux__
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (uint64_t) st.st_size < size) {
+        if (fd != -1) close(fd);
+        throw std::runtime_error("Truncated retrograde database " + file);
+    }
+    void* p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    memory = (byte*) p;
+    mappedBytes = size;
+#else
+    memory = new byte[size];
+    in.seekg(0);
+    if (!in.read((char*) memory, size)) {
+        delete[] memory;
+        throw std::runtime_error("Truncated retrograde database " + file);
+    }
+#endif
+
+    maxPieces = header.maxPieces;
+    for (int i = 0; i <= maxPieces; i++) {
+        slices[i] = memory + header.offsets[i];
+    }
+}
+
+RetroDb::~RetroDb() {
+#ifdef __linux__
+    if (mappedBytes > 0) {
+        munmap(memory, mappedBytes);
+        return;
+    }
+#endif
+    delete[] memory;
+}
+
+void RetroDb::save(const std::string& file, int maxPieces, SliceSource source) {
+    SliceIndex index;
+    if (maxPieces >= SLICES) maxPieces = SLICES - 1;
+
+    DbHeader header;
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, DB_MAGIC, sizeof (DB_MAGIC));
+    header.version = DB_VERSION;
+    header.width = BOARD_WIDTH;
+    header.height = BOARD_HEIGHT;
+    header.popout = POPOUT_ON;
+    header.resultBits = 2;
+    header.maxPieces = maxPieces;
+    uint64_t offset = DB_HEADER_SIZE;
+    for (int i = 0; i <= maxPieces; i++) {
+        header.offsets[i] = offset;
+        header.bytes[i] = packedBytes(index.getSliceSize(i));
+        offset += header.bytes[i];
+    }
+
+    std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+    std::vector<char> padding(DB_HEADER_SIZE, 0);
+    memcpy(&padding[0], &header, sizeof (header));
+    out.write(&padding[0], DB_HEADER_SIZE);
+
+    std::vector<byte> scores;
+    std::vector<byte> packed;
+    for (int i = 0; i <= maxPieces; i++) {
+        scores.assign(index.getSliceSize(i), Connect4::UNKNOWN);
+        source(i, scores);
+        packed.assign(header.bytes[i], 0);
+        for (uint64_t j = 0; j < scores.size(); j++) {
+            int score = scores[j];
+            //only exact scores are kept
+            if ((score & 1) != 0 && score <= Connect4::WIN) {
+                packed[j / 4] |= ((score + 1) / 2) << (j % 4 * 2);
+            }
+        }
+        out.write((const char*) &packed[0], packed.size());
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write retrograde database " + file);
+    }
+}
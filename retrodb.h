@@ -0,0 +1,59 @@
+#ifndef RETRO_DB_H
+#define	RETRO_DB_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "connect4.h"
+#include "retroindex.h"
+
+typedef unsigned char byte;
+
+/**
+ * Read-only database of retrograde analysis results. The file holds the slices of
+ * SliceIndex up to some number of pieces, with 2 bits per position: 0 for unknown,
+ * then LOSS, DRAW and WIN for the player to move. Unknown positions are draws by
+ * repetition, or were not reachable in the analysis.
+ *
+ * On Linux the file is mapped and pages are read only when probed, so opening a
+ * database costs nothing however large it is.
+ */
+class RetroDb {
+    static const int SLICES = SliceIndex::SLICES;
+
+    SliceIndex index;
+    //the start of the mapping or the buffer the file was read into
+    byte* memory;
+    uint64_t mappedBytes;
+    const byte* slices[SLICES];
+    int maxPieces;
+
+public:
+    /**
+     * Fills in one score per position of a slice
+     */
+    typedef std::function<void(int slice, std::vector<byte>& scores)> SliceSource;
+
+    RetroDb(const std::string& file);
+    ~RetroDb();
+
+    /**
+     * Writes the slices with at most maxPieces pieces
+     */
+    static void save(const std::string& file, int maxPieces, SliceSource source);
+
+    //positions with more pieces are not in the database
+    int getMaxPieces() const {
+        return maxPieces;
+    }
+
+    int getScore(bitboard pos) const {
+        int pieces = SliceIndex::countPieces(pos);
+        if (pieces > maxPieces) return Connect4::UNKNOWN;
+        uint64_t i = index.rank(pos);
+        int code = (slices[pieces][i / 4] >> (i % 4 * 2)) & 3;
+        return code == 0 ? Connect4::UNKNOWN : code * 2 - 1;
+    }
+};
+
+#endif
@@ -0,0 +1,415 @@
+#include "retrodisk.h"
+#include "retrodb.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Connect4;
+
+const char MANIFEST_MAGIC[] = "C4RETRODISK";
+const int MANIFEST_VERSION = 1;
+//updates read from each file at a time, every pending file of a slice is open at once
+const uint64_t READ_CHUNK = 1 << 12;
+//update files applied in one pass through a slice, more take several passes
+const int MAX_OPEN_FILES = 256;
+
+/**
+ * Makes sure a file that was written is on the disk before the manifest refers to it
+ */
+static void syncFile(const std::string& file) {
+#ifdef __linux__
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+#endif
+}
+
+RetroDisk::RetroDisk(const std::string& dir, uint64_t size, uint64_t block) : directory(dir), batchSize(size), blockSize(block), nextFile(0), sweeps(0) {
+    if (batchSize == 0) batchSize = 1;
+    if (blockSize == 0) blockSize = 1;
+    for (int i = 0; i < SLICES; i++) {
+        generations[i] = 0;
+    }
+    if (loadManifest()) {
+        std::cout << "Resuming retrograde analysis in " << directory << std::endl;
+    }
+    removeUnused();
+}
+
+std::string RetroDisk::getSliceFile(int slice) const {
+    return getSliceFile(slice, generations[slice]);
+}
+
+std::string RetroDisk::getSliceFile(int slice, int generation) const {
+    std::ostringstream name;
+    name << "slice-" << slice << "-" << generation << ".bin";
+    return name.str();
+}
+
+std::string RetroDisk::newUpdateFile() {
+    std::ostringstream name;
+    name << "updates-" << nextFile++ << ".bin";
+    return name.str();
+}
+
+bool RetroDisk::loadManifest() {
+    std::ifstream in((directory + "/manifest").c_str());
+    if (!in) return false;
+
+    std::string magic;
+    int version, width, height, popout;
+    in >> magic >> version >> width >> height >> popout;
+    if (magic != MANIFEST_MAGIC || version != MANIFEST_VERSION) {
+        throw std::runtime_error("Not a retrograde analysis manifest: " + directory);
+    }
+    if (width != BOARD_WIDTH || height != BOARD_HEIGHT || popout != POPOUT_ON) {
+        throw std::runtime_error("The analysis was started for another game variant: " + directory);
+    }
+
+    std::string label;
+    in >> label >> nextFile >> label >> sweeps;
+    for (int i = 0; i < SLICES; i++) {
+        int slice, count;
+        in >> label >> slice >> generations[i] >> count;
+        if (slice != i) break;
+        pending[i].resize(count);
+        for (int j = 0; j < count; j++) {
+            in >> pending[i][j];
+        }
+    }
+    if (!in) {
+        throw std::runtime_error("Corrupt retrograde analysis manifest: " + directory);
+    }
+    return true;
+}
+
+void RetroDisk::saveManifest() {
+    std::string file = directory + "/manifest";
+    std::ofstream out((file + ".tmp").c_str(), std::ios::trunc);
+    out << MANIFEST_MAGIC << " " << MANIFEST_VERSION << " " << BOARD_WIDTH << " " << BOARD_HEIGHT << " " << POPOUT_ON << std::endl;
+    out << "next " << nextFile << " sweeps " << sweeps << std::endl;
+    for (int i = 0; i < SLICES; i++) {
+        out << "slice " << i << " " << generations[i] << " " << pending[i].size();
+        for (unsigned int j = 0; j < pending[i].size(); j++) {
+            out << " " << pending[i][j];
+        }
+        out << std::endl;
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write retrograde analysis manifest: " + directory);
+    }
+    syncFile(file + ".tmp");
+    if (std::rename((file + ".tmp").c_str(), file.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace retrograde analysis manifest: " + directory);
+    }
+}
+
+/**
+ * Deletes the files that a step wrote before it was interrupted
+ */
+void RetroDisk::removeUnused() {
+#ifdef __linux__
+    std::set<std::string> used;
+    for (int i = 0; i < SLICES; i++) {
+        if (generations[i] > 0) used.insert(getSliceFile(i));
+        used.insert(pending[i].begin(), pending[i].end());
+    }
+
+    DIR* dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        throw std::runtime_error("Cannot open directory " + directory);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name = entry->d_name;
+        if ((name.compare(0, 6, "slice-") == 0 || name.compare(0, 8, "updates-") == 0) && used.count(name) == 0) {
+            std::remove((directory + "/" + name).c_str());
+        }
+    }
+    closedir(dir);
+#endif
+}
+
+void RetroDisk::solve() {
+    for (int i = 0; i < SLICES; i++) {
+        if (generations[i] == 0) {
+            initSlice(i);
+        }
+    }
+
+    while (!isSolved()) {
+        for (int i = 0; i < SLICES; i++) {
+            //a slice does not send updates to itself
+            while (!pending[i].empty()) {
+                processSlice(i);
+            }
+        }
+        sweeps++;
+        saveManifest();
+    }
+}
+
+bool RetroDisk::isSolved() const {
+    for (int i = 0; i < SLICES; i++) {
+        if (generations[i] == 0 || !pending[i].empty()) return false;
+    }
+    return true;
+}
+
+int RetroDisk::getScore(bitboard pos) const {
+    int slice = SliceIndex::countPieces(pos);
+    if (generations[slice] == 0) return UNKNOWN;
+
+    std::ifstream in((directory + "/" + getSliceFile(slice)).c_str(), std::ios::binary);
+    in.seekg(index.rank(pos));
+    char state;
+    if (!in.get(state)) {
+        throw std::runtime_error("Cannot read slice " + getSliceFile(slice));
+    }
+    if ((state & FINISHED) == 0) return UNKNOWN;
+    return state & SCORE_MASK;
+}
+
+void RetroDisk::save(const std::string& file, int maxPieces) const {
+    //the unresolved positions of the database are taken to be draws
+    if (!isSolved()) {
+        throw std::runtime_error("The analysis in " + directory + " is not finished");
+    }
+    RetroDb::save(file, maxPieces, [this](int slice, std::vector<byte>& scores) {
+        if (generations[slice] == 0) return;
+        std::ifstream in((directory + "/" + getSliceFile(slice)).c_str(), std::ios::binary);
+        if (!in.read((char*) &scores[0], scores.size())) {
+            throw std::runtime_error("Cannot read slice " + getSliceFile(slice));
+        }
+        for (uint64_t i = 0; i < scores.size(); i++) {
+            scores[i] = (scores[i] & FINISHED) != 0 ? scores[i] & SCORE_MASK : UNKNOWN;
+        }
+    });
+}
+
+/**
+ * Sets the state of every position in the slice, and sends the scores of the
+ * terminal positions to their parents
+ */
+void RetroDisk::initSlice(int slice) {
+    uint64_t size = index.getSliceSize(slice);
+    std::vector<byte> states;
+    Outgoing outgoing[SLICES];
+    std::string file = directory + "/" + getSliceFile(slice, generations[slice] + 1);
+    std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+
+    for (uint64_t begin = 0; begin < size; begin += blockSize) {
+        states.resize(std::min(blockSize, size - begin));
+        for (uint64_t j = 0; j < states.size(); j++) {
+            bitboard current, other;
+            splitPosition(index.unrank(slice, begin + j), current, other);
+
+            byte state;
+            if (hasWon(other)) {
+                state = FINISHED | LOSS;
+            } else if (hasWon(current)) {
+                state = FINISHED | WIN;
+            } else {
+                state = 0;
+                for (int x = 0; x < WIDTH; x++) {
+                    bitboard c = current, o = other;
+                    if (drop(c, o, x)) state++;
+#if POPOUT_ON
+                    c = current;
+                    o = other;
+                    if (pop(c, o, x)) state++;
+#endif
+                }
+                if ((current | other) == FULL) {
+                    state = state == 0 ? FINISHED | DRAW : state | HAS_DRAW;
+                }
+            }
+
+            states[j] = state;
+            if ((state & FINISHED) != 0) {
+                resolve(slice, current, other, state & SCORE_MASK, outgoing);
+            }
+        }
+        out.write((const char*) &states[0], states.size());
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write slice " + file);
+    }
+    //updates that neighbouring slices sent already wait for the first pass
+    commit(slice, outgoing, 0);
+}
+
+/**
+ * Gives the next update of the file if it is for a state before end
+ */
+bool RetroDisk::nextUpdate(UpdateReader& reader, uint64_t end, uint64_t& update) {
+    if (reader.next == reader.chunk.size()) {
+        reader.chunk.resize(READ_CHUNK);
+        reader.in->read((char*) &reader.chunk[0], READ_CHUNK * sizeof (uint64_t));
+        reader.chunk.resize(reader.in->gcount() / sizeof (uint64_t));
+        reader.next = 0;
+        if (reader.chunk.empty()) {
+            if (reader.in->bad()) throw std::runtime_error("Cannot read updates " + reader.file);
+            return false;
+        }
+    }
+    if ((reader.chunk[reader.next] >> 2) >= end) return false;
+    update = reader.chunk[reader.next++];
+    return true;
+}
+
+/**
+ * Applies the oldest MAX_OPEN_FILES pending update files of the slice, and sends
+ * the scores of the positions that they resolve to their parents
+ */
+void RetroDisk::processSlice(int slice) {
+    uint64_t size = index.getSliceSize(slice);
+    std::vector<byte> states;
+    std::string sliceFile = directory + "/" + getSliceFile(slice);
+    std::ifstream in(sliceFile.c_str(), std::ios::binary);
+    std::string file = directory + "/" + getSliceFile(slice, generations[slice] + 1);
+    std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+
+    std::vector<UpdateReader> readers(std::min((int) pending[slice].size(), MAX_OPEN_FILES));
+    for (unsigned int f = 0; f < readers.size(); f++) {
+        readers[f].file = directory + "/" + pending[slice][f];
+        readers[f].in = std::make_shared<std::ifstream>(readers[f].file.c_str(), std::ios::binary);
+        readers[f].next = 0;
+        if (!*readers[f].in) {
+            throw std::runtime_error("Cannot read updates " + readers[f].file);
+        }
+    }
+
+    Outgoing outgoing[SLICES];
+    for (uint64_t begin = 0; begin < size; begin += blockSize) {
+        states.resize(std::min(blockSize, size - begin));
+        if (!in.read((char*) &states[0], states.size())) {
+            throw std::runtime_error("Cannot read slice " + sliceFile);
+        }
+
+        uint64_t update;
+        for (unsigned int f = 0; f < readers.size(); f++) {
+            while (nextUpdate(readers[f], begin + states.size(), update)) {
+                uint64_t i = update >> 2;
+                int childScore = (update & 3) * 2 - 1;
+                byte state = states[i - begin];
+                if ((state & FINISHED) != 0) continue;
+
+                if (childScore == LOSS) {
+                    state = FINISHED | WIN;
+                } else {
+                    if (childScore == DRAW) {
+                        state |= HAS_DRAW;
+                    }
+                    assert((state & SCORE_MASK) > 0);
+                    state--;
+                    if ((state & SCORE_MASK) == 0) {
+                        state = FINISHED | ((state & HAS_DRAW) != 0 ? DRAW : LOSS);
+                    }
+                }
+                states[i - begin] = state;
+
+                if ((state & FINISHED) != 0) {
+                    bitboard current, other;
+                    splitPosition(index.unrank(slice, i), current, other);
+                    resolve(slice, current, other, state & SCORE_MASK, outgoing);
+                }
+            }
+        }
+        out.write((const char*) &states[0], states.size());
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Cannot write slice " + file);
+    }
+    commit(slice, outgoing, readers.size());
+}
+
+/**
+ * Queues an update for every parent of a resolved position
+ */
+void RetroDisk::resolve(int slice, bitboard current, bitboard other, byte score, Outgoing(&outgoing)[SLICES]) {
+    //LOSS, DRAW and WIN become 1, 2 and 3
+    uint64_t code = (score + 1) / 2;
+    for (int x = 0; x < WIDTH; x++) {
+        bitboard c = current, o = other;
+        if (undrop(c, o, x)) {
+            Outgoing& out = outgoing[slice - 1];
+            out.updates.push_back((index.rank(getPosition(c, o)) << 2) | code);
+            if (out.updates.size() >= batchSize) flush(out);
+        }
+#if POPOUT_ON
+        c = current;
+        o = other;
+        if (unpop(c, o, x)) {
+            Outgoing& out = outgoing[slice + 1];
+            out.updates.push_back((index.rank(getPosition(c, o)) << 2) | code);
+            if (out.updates.size() >= batchSize) flush(out);
+        }
+#endif
+    }
+}
+
+/**
+ * Writes the buffered updates for a slice to a new file, sorted so that they are
+ * applied in one pass through the slice
+ */
+void RetroDisk::flush(Outgoing& out) {
+    if (out.updates.empty()) return;
+
+    std::sort(out.updates.begin(), out.updates.end());
+    std::string name = newUpdateFile();
+    std::string file = directory + "/" + name;
+    std::ofstream updateOut(file.c_str(), std::ios::binary | std::ios::trunc);
+    updateOut.write((const char*) &out.updates[0], out.updates.size() * sizeof (uint64_t));
+    updateOut.close();
+    if (!updateOut) {
+        throw std::runtime_error("Cannot write updates " + file);
+    }
+    syncFile(file);
+    out.files.push_back(name);
+    out.updates.clear();
+}
+
+/**
+ * Saves the updates the slice sent and records them in the manifest with the new
+ * states of the slice, which are written to the file of its next generation. The
+ * files that are replaced, including the first applied pending update files of
+ * the slice, are deleted last.
+ */
+void RetroDisk::commit(int slice, Outgoing(&outgoing)[SLICES], int applied) {
+    for (int i = 0; i < SLICES; i++) {
+        flush(outgoing[i]);
+    }
+
+    std::string oldSlice = generations[slice] > 0 ? getSliceFile(slice) : "";
+    std::vector<std::string> consumed(pending[slice].begin(), pending[slice].begin() + applied);
+    pending[slice].erase(pending[slice].begin(), pending[slice].begin() + applied);
+
+    generations[slice]++;
+    syncFile(directory + "/" + getSliceFile(slice));
+
+    for (int i = 0; i < SLICES; i++) {
+        pending[i].insert(pending[i].end(), outgoing[i].files.begin(), outgoing[i].files.end());
+    }
+    saveManifest();
+
+    if (!oldSlice.empty()) std::remove((directory + "/" + oldSlice).c_str());
+    for (unsigned int i = 0; i < consumed.size(); i++) {
+        std::remove((directory + "/" + consumed[i]).c_str());
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef RETRO_DISK_H
+#define	RETRO_DISK_H
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "connect4.h"
+#include "retroindex.h"
+
+typedef unsigned char byte;
+
+/**
+ * Retrograde analysis for boards whose states do not fit in memory. The positions
+ * are split into slices by piece count, and each slice is a file with one state
+ * byte per SliceIndex. A slice is read, updated and written in blocks of blockSize
+ * states, so memory use does not depend on the size of the slices: it is a block,
+ * the update buffers of the two neighbouring slices and a chunk of every update
+ * file being read, of which there are at most MAX_OPEN_FILES.
+ *
+ * A drop adds a piece and a pop removes one, so the parents of a position are in
+ * the two neighbouring slices. When a position is resolved, an update for each
+ * parent is added to a buffer for the parent's slice, which is sorted and written
+ * to a file when it holds batchSize updates. A slice is processed by reading its
+ * pending update files alongside the blocks, MAX_OPEN_FILES at a time. Each file
+ * is sorted, so the updates of a block are the next ones in every file. The
+ * slices are swept until no updates are pending.
+ *
+ * Every position of the board is analysed, not just the reachable ones. Unreachable
+ * positions are never the children of reachable ones, so this does not change any
+ * score that matters.
+ *
+ * After every slice the progress is recorded in a manifest that replaces the old
+ * one atomically. New files get new names, and the files a step replaces are
+ * deleted only after the manifest is written, so an interrupted analysis resumes
+ * from the last completed slice.
+ */
+class RetroDisk {
+public:
+    static const uint64_t DEFAULT_BATCH_SIZE = 1 << 24;
+    static const uint64_t DEFAULT_BLOCK_SIZE = 1 << 28;
+
+private:
+    static const int WIDTH = BOARD_WIDTH;
+    static const int HEIGHT = BOARD_HEIGHT;
+    static const int SLICES = SliceIndex::SLICES;
+
+    //the state bytes are the same as in Retro
+    static const byte FINISHED = 64;
+    static const byte HAS_DRAW = 32;
+    static const byte SCORE_MASK = 15;
+
+    typedef struct {
+        std::vector<uint64_t> updates;
+        std::vector<std::string> files;
+    } Outgoing;
+
+    //a sorted update file that is read a chunk at a time
+    typedef struct {
+        std::string file;
+        std::shared_ptr<std::ifstream> in;
+        std::vector<uint64_t> chunk;
+        uint64_t next;
+    } UpdateReader;
+
+    SliceIndex index;
+    std::string directory;
+    uint64_t batchSize;
+    uint64_t blockSize;
+
+    //0 until the slice has been initialized
+    int generations[SLICES];
+    std::vector<std::string> pending[SLICES];
+    uint64_t nextFile;
+    int sweeps;
+
+    std::string getSliceFile(int slice) const;
+    std::string getSliceFile(int slice, int generation) const;
+    std::string newUpdateFile();
+
+    bool loadManifest();
+    void saveManifest();
+    void removeUnused();
+    void commit(int slice, Outgoing(&outgoing)[SLICES], int applied);
+
+    void initSlice(int slice);
+    void processSlice(int slice);
+    bool nextUpdate(UpdateReader& reader, uint64_t end, uint64_t& update);
+    void resolve(int slice, bitboard current, bitboard other, byte score, Outgoing(&outgoing)[SLICES]);
+    void flush(Outgoing& out);
+
+public:
+    /**
+     * Continues the analysis saved in the directory if there is one. The batch size
+     * is in updates of 8 bytes and the block size in states of one byte.
+     */
+    RetroDisk(const std::string& directory, uint64_t batchSize = DEFAULT_BATCH_SIZE, uint64_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    /**
+     * Runs the analysis to the end. Returns immediately if it is done already.
+     */
+    void solve();
+
+    bool isSolved() const;
+
+    //reads the score from the slice file, UNKNOWN for draws by repetition
+    int getScore(bitboard pos) const;
+
+    /**
+     * Writes the scores of the positions with at most maxPieces pieces to a
+     * database that RetroDb loads
+     */
+    void save(const std::string& file, int maxPieces = SLICES - 1) const;
+
+    int getSweeps() const {
+        return sweeps;
+    }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "retroindex.h"
+
+RetroIndex::RetroIndex() {
+    uint64_t all = MIDDLE_DIGITS;
+    uint64_t symmetric = MIDDLE_DIGITS;
+    for (int r = 0; r <= PAIRS; r++) {
+        free[r] = all;
+        //every pair of mirror images is counted once, symmetric positions are their own
+        canonical[r] = (all + symmetric) / 2;
+        all *= BASE * BASE;
+        symmetric *= BASE;
+    }
+}
+
+/**
+ * Returns the canonical position with the given index
+ */
+bitboard RetroIndex::unrank(uint64_t index) const {
+    uint64_t digits[WIDTH];
+    int i = 0;
+    for (; i < PAIRS; i++) {
+        int rest = PAIRS - 1 - i;
+        if (index < BASE * canonical[rest]) {
+            digits[i] = digits[WIDTH - 1 - i] = index / canonical[rest];
+            index %= canonical[rest];
+            continue;
+        }
+
+        index -= BASE * canonical[rest];
+        uint64_t pair = index / free[rest];
+        index %= free[rest];
+        uint64_t right = 1;
+        while ((right + 1) * right / 2 <= pair) {
+            right++;
+        }
+        digits[i] = pair - right * (right - 1) / 2;
+        digits[WIDTH - 1 - i] = right;
+
+        //the rest is free, the middle column is the last digit
+        if (WIDTH % 2 == 1) {
+            digits[PAIRS] = index % BASE;
+            index /= BASE;
+        }
+        for (int j = PAIRS - 1; j > i; j--) {
+            digits[WIDTH - 1 - j] = index % BASE;
+            index /= BASE;
+            digits[j] = index % BASE;
+            index /= BASE;
+        }
+        break;
+    }
+    if (i == PAIRS && WIDTH % 2 == 1) {
+        digits[PAIRS] = index;
+    }
+
+    bitboard pos = 0;
+    for (int column = WIDTH - 1; column >= 0; column--) {
+        pos = (pos << Connect4::H1) | (digits[column] + 1);
+    }
+    return pos;
+}
+
+SliceIndex::SliceIndex() {
+    for (int w = 0; w <= WIDTH; w++) {
+        for (int m = 0; m < SLICES; m++) {
+            if (w == 0) {
+                ways[w][m] = m == 0 ? 1 : 0;
+                continue;
+            }
+            ways[w][m] = 0;
+            for (int h = 0; h <= HEIGHT && h <= m; h++) {
+                ways[w][m] += ways[w - 1][m - h];
+            }
+        }
+    }
+}
+
+uint64_t SliceIndex::rank(bitboard pos) const {
+    int left = countPieces(pos);
+    int pieces = left;
+    uint64_t heights = 0;
+    uint64_t colours = 0;
+    for (int i = 0; i < WIDTH; i++) {
+        int height = getHeight(pos, i);
+        //the columns heights with a lower height here come first
+        for (int h = 0; h < height; h++) {
+            heights += ways[WIDTH - 1 - i][left - h];
+        }
+        left -= height;
+        colours = (colours << height) | ((pos >> (i * Connect4::H1)) & (((bitboard) 1 << height) - 1));
+    }
+    return (heights << pieces) | colours;
+}
+
+bitboard SliceIndex::unrank(int pieces, uint64_t index) const {
+    uint64_t colours = index & (((uint64_t) 1 << pieces) - 1);
+    uint64_t heights = index >> pieces;
+    int height[WIDTH];
+    int left = pieces;
+    for (int i = 0; i < WIDTH; i++) {
+        int h = 0;
+        while (heights >= ways[WIDTH - 1 - i][left - h]) {
+            heights -= ways[WIDTH - 1 - i][left - h];
+            h++;
+        }
+        height[i] = h;
+        left -= h;
+    }
+
+    //the colours of the last column are the lowest bits
+    bitboard pos = 0;
+    for (int i = WIDTH - 1; i >= 0; i--) {
+        bitboard column = ((bitboard) 1 << height[i]) | (colours & (((bitboard) 1 << height[i]) - 1));
+        colours >>= height[i];
+        pos |= column << (i * Connect4::H1);
+    }
+    return pos;
+}
@@ -0,0 +1,145 @@
+#ifndef RETRO_INDEX_H
+#define	RETRO_INDEX_H
+
+#include "connect4.h"
+
+/**
+ * Numbers the positions of the board densely, with a position and its mirror image
+ * sharing one index.
+ *
+ * A column of a position holds a value from 1 to 2^(HEIGHT + 1) - 1, one bit per
+ * piece under the height bit, so a position is a sequence of WIDTH digits in base
+ * BASE once 1 is subtracted. The columns are taken in pairs from the outside in.
+ * Of a position and its mirror image the canonical one is the one whose first
+ * unequal pair has the smaller digit on the left. The canonical positions are
+ * ranked by counting, for every pair, the canonical positions that come before it:
+ * while all pairs so far are equal, the rest of the position must again be
+ * canonical, after the first unequal pair it is free.
+ */
+class RetroIndex {
+    static const int WIDTH = BOARD_WIDTH;
+    static const int PAIRS = WIDTH / 2;
+    static const uint64_t BASE = ((uint64_t) 1 << (BOARD_HEIGHT + 1)) - 1;
+    static const uint64_t MIDDLE_DIGITS = WIDTH % 2 == 1 ? BASE : 1;
+
+    //canonical positions of the last r pairs and the middle column
+    uint64_t canonical[PAIRS + 1];
+    //all positions of the last r pairs and the middle column
+    uint64_t free[PAIRS + 1];
+
+    static uint64_t getDigit(bitboard pos, int column) {
+        return ((pos >> (column * Connect4::H1)) & Connect4::COL1) - 1;
+    }
+
+public:
+    RetroIndex();
+
+    //the number of indexes
+    uint64_t getSize() const {
+        return canonical[PAIRS];
+    }
+
+    /**
+     * Mirrors every column of a board, also boards without height bits
+     */
+    static bitboard mirror(bitboard board) {
+        bitboard mirrored = 0;
+        for (int i = 0; i < WIDTH; i++) {
+            mirrored = (mirrored << Connect4::H1) | (board & Connect4::COL1);
+            board >>= Connect4::H1;
+        }
+        return mirrored;
+    }
+
+    static bool isCanonical(bitboard pos) {
+        for (int i = 0; i < PAIRS; i++) {
+            uint64_t left = getDigit(pos, i);
+            uint64_t right = getDigit(pos, WIDTH - 1 - i);
+            if (left != right) return left < right;
+        }
+        return true;
+    }
+
+    static bitboard normalize(bitboard pos) {
+        return isCanonical(pos) ? pos : mirror(pos);
+    }
+
+    /**
+     * The position must be canonical
+     */
+    uint64_t rank(bitboard pos) const {
+        uint64_t index = 0;
+        for (int i = 0; i < PAIRS; i++) {
+            int rest = PAIRS - 1 - i;
+            uint64_t left = getDigit(pos, i);
+            uint64_t right = getDigit(pos, WIDTH - 1 - i);
+            if (left == right) {
+                index += left * canonical[rest];
+                continue;
+            }
+
+            //unequal pairs come after the equal ones, and the rest is free
+            index += BASE * canonical[rest] + (right * (right - 1) / 2 + left) * free[rest];
+            uint64_t tail = 0;
+            for (int j = i + 1; j < PAIRS; j++) {
+                tail = (tail * BASE + getDigit(pos, j)) * BASE + getDigit(pos, WIDTH - 1 - j);
+            }
+            if (WIDTH % 2 == 1) tail = tail * BASE + getDigit(pos, PAIRS);
+            return index + tail;
+        }
+        return WIDTH % 2 == 1 ? index + getDigit(pos, PAIRS) : index;
+    }
+
+    uint64_t rankAny(bitboard pos) const {
+        return rank(normalize(pos));
+    }
+
+    bitboard unrank(uint64_t index) const;
+};
+
+/**
+ * Numbers the positions with the same number of pieces densely. A position is the
+ * heights of its columns, which sum to the piece count n, and n bits that tell
+ * whose the pieces are. The heights are ranked among all columns heights with the
+ * same sum, so a slice has getSliceSize(n) = compositions * 2^n positions. Mirror
+ * images are not merged.
+ */
+class SliceIndex {
+    static const int WIDTH = BOARD_WIDTH;
+    static const int HEIGHT = BOARD_HEIGHT;
+
+    //ways to fill the last w columns with m pieces
+    uint64_t ways[WIDTH + 1][WIDTH * HEIGHT + 1];
+
+public:
+    static const int SLICES = WIDTH * HEIGHT + 1;
+
+    SliceIndex();
+
+    uint64_t getSliceSize(int pieces) const {
+        return ways[WIDTH][pieces] << pieces;
+    }
+
+    static int getHeight(bitboard pos, int column) {
+        bitboard value = (pos >> (column * Connect4::H1)) & Connect4::COL1;
+        int height = 0;
+        while (value >>= 1) {
+            height++;
+        }
+        return height;
+    }
+
+    static int countPieces(bitboard pos) {
+        int pieces = 0;
+        for (int i = 0; i < WIDTH; i++) {
+            pieces += getHeight(pos, i);
+        }
+        return pieces;
+    }
+
+    //the index of a position among those with the same number of pieces
+    uint64_t rank(bitboard pos) const;
+    bitboard unrank(int pieces, uint64_t index) const;
+};
+
+#endif
@@ -1,8 +1,13 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+//the board can be made smaller from the command line, as the pns check does
+#ifndef BOARD_WIDTH
 #define BOARD_WIDTH 7
+#endif
+#ifndef BOARD_HEIGHT
 #define BOARD_HEIGHT 6
+#endif
 
 //enable pop moves (if disabled, the game is then standard Connect-4)
 #define POPOUT_ON 1
@@ -1,84 +1,456 @@
 #include "transtable.h"
-#include <cstring>
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const int CACHE_LINE = 64;
+const uint64_t HUGE_PAGE = 2 * 1024 * 1024;
+//smaller tables are cleared on one thread
+const uint64_t PARALLEL_CLEAR_LIMIT = 64 * 1024 * 1024;
+
+//snapshot files start with a header padded to a page so the buckets can be mapped
+const char SNAPSHOT_MAGIC[8] = "C4TRANS";
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint64_t SNAPSHOT_HEADER_SIZE = 4096;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t popout;
+    //entry layout
+    uint32_t ways;
+    uint32_t keyShift;
+    uint32_t scoreBits;
+    uint32_t workBits;
+    uint32_t generationBits;
+    uint32_t generation;
+    uint64_t hashMultiplier;
+    uint64_t bucketCount;
+    uint64_t stored;
+} SnapshotHeader;
+
+#if TRANS_STATS_ON
+//the slot of the thread in TransTable::threadStats, the threads of a search get consecutive ones
+static int getStatsSlot() {
+    static std::atomic<unsigned int> nextSlot(0);
+    static thread_local unsigned int slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+}
+
+static void increment(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+#define COUNT(counter) increment(threadStats[getStatsSlot() % STATS_SLOTS].counter)
+#else
+#define COUNT(counter)
+#endif
+
+static bool isExact(entry e) {
+    return (e & 1) != 0;
+}
+
+static int highestBit(uint64_t n) {
+    int bits = 0;
+    while (n >>= 1) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Zeroes the memory with one thread per core. The first thread to touch a page
+ * decides on which NUMA node it is placed, so on a fresh table this also spreads
+ * the pages over the nodes.
+ */
+static void parallelClear(void* memory, uint64_t bytes) {
+    unsigned int threads = bytes < PARALLEL_CLEAR_LIMIT ? 1 : std::thread::hardware_concurrency();
+    if (threads <= 1) {
+        memset(memory, 0, bytes);
+        return;
+    }
 
-int getIndexSize(int transSize) {
-    int indexSize = 0;
-    while (transSize > 0) {
-        indexSize++;
-        transSize >>= 1;
+    //whole huge pages per thread
+    uint64_t chunk = (bytes / threads + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+    std::vector<std::thread> workers;
+    for (uint64_t begin = 0; begin < bytes; begin += chunk) {
+        char* start = (char*) memory + begin;
+        uint64_t length = std::min(chunk, bytes - begin);
+        workers.push_back(std::thread([start, length]() {
+            memset(start, 0, length);
+        }));
     }
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+TransTable::TransTable(uint64_t size, int w) : memory(NULL), table(NULL), mappedBytes(0), hugePages(false), generation(0), cold(NULL), spillWork(DEFAULT_SPILL_WORK) {
+    ways = 1;
+    while (ways < w && ways * (int) sizeof (entry) < CACHE_LINE) {
+        ways *= 2;
+    }
+
+    int bucketBits = size < (uint64_t) ways ? -1 : highestBit(size / ways);
+    if (bucketBits > POSITION_BITS) bucketBits = POSITION_BITS;
+    init(bucketBits);
+
+    if (bucketCount > 0) {
+        allocate(getSize() * sizeof (entry));
+    }
+    stored = 0;
+    resetStats();
+}
+
+/**
+ * Opens a snapshot written by save(). On Linux the file is mapped copy-on-write, so
+ * the old entries are available immediately and pages are read only when probed.
+ * Changes are not written back to the file unless the table is saved again.
+ */
+TransTable::TransTable(const std::string& file) : memory(NULL), table(NULL), mappedBytes(0), hugePages(false), cold(NULL), spillWork(DEFAULT_SPILL_WORK) {
+    std::ifstream in(file.c_str(), std::ios::binary);
+    SnapshotHeader header;
+    if (!in.read((char*) &header, sizeof (header))) {
+        throw std::runtime_error("Cannot read transposition table " + file);
+    }
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Not a transposition table snapshot: " + file);
+    }
+    if (header.width != BOARD_WIDTH || header.height != BOARD_HEIGHT || header.popout != POPOUT_ON) {
+        throw std::runtime_error("The snapshot was saved for another game variant: " + file);
+    }
+    if (header.keyShift != KEY_SHIFT || header.scoreBits != SCORE_BITS || header.workBits != WORK_BITS
+            || header.generationBits != GENERATION_BITS || header.hashMultiplier != HASH_MULTIPLIER
+            || header.ways == 0 || header.ways * sizeof (entry) > CACHE_LINE || (header.ways & (header.ways - 1)) != 0
+            || header.bucketCount == 0 || (header.bucketCount & (header.bucketCount - 1)) != 0) {
+        throw std::runtime_error("The snapshot has a different entry layout: " + file);
+    }
+
+    ways = header.ways;
+    init(highestBit(header.bucketCount));
+    generation = header.generation;
+    stored = header.stored;
+    resetStats();
+    uint64_t bytes = getSize() * sizeof (entry);
 
-    return indexSize - 1;
+#ifdef __linux__
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || (uint64_t) st.st_size < SNAPSHOT_HEADER_SIZE + bytes) {
+        if (fd != -1) close(fd);
+        throw std::runtime_error("Truncated transposition table " + file);
+    }
+    void* p = mmap(NULL, SNAPSHOT_HEADER_SIZE + bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    mappedBytes = SNAPSHOT_HEADER_SIZE + bytes;
+    memory = (std::atomic<entry>*) p;
+    table = (std::atomic<entry>*) ((char*) p + SNAPSHOT_HEADER_SIZE);
+#else
+    allocate(bytes);
+    in.seekg(SNAPSHOT_HEADER_SIZE);
+    if (!in.read((char*) table, bytes)) {
+        throw std::runtime_error("Truncated transposition table " + file);
+    }
+#endif
 }
 
-TransTable::TransTable(unsigned int size) {
-    transSize = size;
-    table = new entry[2 * transSize]();
+/**
+ * Sets up the hashing for 2^bucketBits buckets, or for no buckets if bucketBits is negative
+ */
+void TransTable::init(int bucketBits) {
+    bucketCount = bucketBits < 0 ? 0 : (uint64_t) 1 << bucketBits;
+    if (bucketBits < 0) bucketBits = 0;
 
-    indexSize = getIndexSize(transSize);
-    keySize = (BOARD_WIDTH * (BOARD_HEIGHT + 1)) - indexSize;
-    if (keySize < 0) keySize = 0;
-    keyScoreSize = keySize + 3;
+    keySize = POSITION_BITS - bucketBits;
+    hashMask = ((entry) 1 << POSITION_BITS) - 1;
     keyMask = ((entry) 1 << keySize) - 1;
-    scoreMask = (((entry) 1 << keyScoreSize) - 1) ^ keyMask;
-    workMask = ~0 ^ (keyMask | scoreMask);
-    maxWork = ((uint64_t) 1 << ((sizeof (entry)*8) - keyScoreSize)) - 1;
-    reset();
+    assert(KEY_SHIFT + keySize <= 64);
+}
+
+/**
+ * Writes the table to a file that can be opened later. Must not be called while
+ * other threads are storing to the table.
+ */
+void TransTable::save(const std::string& file) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof (header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof (SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.width = BOARD_WIDTH;
+    header.height = BOARD_HEIGHT;
+    header.popout = POPOUT_ON;
+    header.ways = ways;
+    header.keyShift = KEY_SHIFT;
+    header.scoreBits = SCORE_BITS;
+    header.workBits = WORK_BITS;
+    header.generationBits = GENERATION_BITS;
+    header.generation = generation;
+    header.hashMultiplier = HASH_MULTIPLIER;
+    header.bucketCount = bucketCount;
+    header.stored = stored;
+
+    //a table loaded from the file is mapped from it, so the file is replaced instead of rewritten
+    std::string temporary = file + ".tmp";
+    std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+    std::vector<char> padding(SNAPSHOT_HEADER_SIZE, 0);
+    memcpy(&padding[0], &header, sizeof (header));
+    out.write(&padding[0], SNAPSHOT_HEADER_SIZE);
+    out.write((const char*) table, getSize() * sizeof (entry));
+    out.close();
+    if (!out) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot write transposition table " + file);
+    }
+    if (std::rename(temporary.c_str(), file.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace transposition table " + file);
+    }
 }
 
 TransTable::~TransTable() {
-    delete[] table;
+#ifdef __linux__
+    if (mappedBytes > 0) {
+        munmap(memory, mappedBytes);
+        return;
+    }
+#endif
+    delete[] memory;
 }
 
 /**
- * Inits transposition table to zeroes
+ * Allocates zeroed memory for the buckets. On Linux large tables are mapped with
+ * huge pages from hugetlbfs if any are reserved, otherwise transparent huge pages
+ * are requested. Both save TLB misses on random probes.
+ */
+void TransTable::allocate(uint64_t bytes) {
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE) {
+        uint64_t length = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        void* p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            hugePages = true;
+            mappedBytes = length;
+            memory = table = (std::atomic<entry>*) p;
+        } else {
+            //one extra huge page so that the table can start on a huge page boundary
+            length += HUGE_PAGE;
+            p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) throw std::bad_alloc();
+            mappedBytes = length;
+            memory = (std::atomic<entry>*) p;
+            uintptr_t offset = (uintptr_t) p % HUGE_PAGE;
+            table = (std::atomic<entry>*) ((char*) p + (offset == 0 ? 0 : HUGE_PAGE - offset));
+#ifdef MADV_HUGEPAGE
+            madvise(table, length - HUGE_PAGE, MADV_HUGEPAGE);
+#endif
+        }
+        //the pages are zero already, this just faults them in on all nodes
+        parallelClear(table, bytes);
+        return;
+    }
+#endif
+
+    //allocate one extra cache line so that the buckets can be aligned
+    int slack = CACHE_LINE / sizeof (entry);
+    memory = new std::atomic<entry>[bytes / sizeof (entry) + slack];
+    uintptr_t offset = (uintptr_t) memory % CACHE_LINE;
+    table = offset == 0 ? memory : memory + (CACHE_LINE - offset) / sizeof (entry);
+    parallelClear(table, bytes);
+}
+
+/**
+ * Inits transposition table to zeroes, and empties the cold tier. Must not be called
+ * while other threads are using the table.
  */
 void TransTable::reset() {
-    memset(table, 0, 2 * transSize * sizeof (bitboard));
-    stored = 0;
+    //a table that has not been stored to is still zero
+    if (stored.load() != 0) {
+        parallelClear(table, getSize() * sizeof (entry));
+    }
+    stored.store(0);
+    generation = 0;
+    resetStats();
+    if (cold != NULL) cold->reset();
+}
+
+void TransTable::resetStats() {
+#if TRANS_STATS_ON
+    for (int t = 0; t < STATS_SLOTS; t++) {
+        ThreadStats& counters = threadStats[t];
+        counters.probes = 0;
+        for (int i = 0; i < TransStats::MAX_WAYS; i++) {
+            counters.hits[i] = 0;
+        }
+        counters.collisions = 0;
+        counters.updates = 0;
+        counters.inserts = 0;
+        counters.replacements = 0;
+        counters.exactOverwrites = 0;
+    }
+#endif
 }
 
 void TransTable::store(bitboard pos, unsigned int score, uint64_t nodes) {
     assert(score <= Connect4::WIN);
-    if (transSize == 0) return;
+    if (bucketCount == 0) return;
 
-    if (nodes > maxWork) {
-        std::cout << "Max work (=" << maxWork << ") exceeded: " << nodes << std::endl;
-        nodes = maxWork;
-    }
-    stored++;
-    int index = (pos % transSize)*2;
-    entry key = pos >> indexSize;
+    stored.fetch_add(1, std::memory_order_relaxed);
+    entry key;
+    std::atomic<entry>* bucket = getBucket(pos, key);
+
+    entry work = highestBit(nodes);
+    if (work > WORK_MASK) work = WORK_MASK;
+    entry whole = (key << KEY_SHIFT) | ((entry) generation << GENERATION_SHIFT) | (work << WORK_SHIFT) | score;
 
-    entry whole = key | ((entry) score << keySize) | (nodes << keyScoreSize);
-    assert(((whole & scoreMask) >> keySize) == score);
+    //relaxed ordering is enough since each slot is self-contained
+    //replace the same position if it exists, then an empty slot, then the least valuable entry
+    int same = -1;
+    int empty = -1;
+    int victim = 0;
+    int lowest = 0;
+    entry old = 0;
+    for (int i = 0; i < ways; i++) {
+        entry e = bucket[i].load(std::memory_order_relaxed);
+        if ((e & SCORE_MASK) == 0) {
+            if (empty == -1) empty = i;
+            continue;
+        }
+        if ((e >> KEY_SHIFT) == key) {
+            same = i;
+            old = e;
+            break;
+        }
 
-    entry first = table[index];
-    if ((first & keyMask) == key) {
-        table[index] = whole;
-    } else if (nodes >= (first >> keyScoreSize)) {
-        table[index + 1] = first;
-        table[index] = whole;
+        int age = (generation - ((e >> GENERATION_SHIFT) & GENERATION_MASK)) & GENERATION_MASK;
+        int value = (int) ((e >> WORK_SHIFT) & WORK_MASK) - AGE_WEIGHT * age;
+        if (i == 0 || value < lowest) {
+            victim = i;
+            lowest = value;
+            old = e;
+        }
+    }
+    if (same != -1) {
+        victim = same;
+        COUNT(updates);
+    } else if (empty != -1) {
+        victim = empty;
+        old = 0;
+        COUNT(inserts);
     } else {
-        table[index + 1] = whole;
+        COUNT(replacements);
+        if (cold != NULL && (int) ((old >> WORK_SHIFT) & WORK_MASK) >= spillWork) {
+            cold->spill(getPosition(bucket, old >> KEY_SHIFT), old & SCORE_MASK, (old >> WORK_SHIFT) & WORK_MASK);
+        }
+    }
+    if (old != 0 && isExact(old) && !isExact(score)) {
+        COUNT(exactOverwrites);
     }
+
+    bucket[victim].store(whole, std::memory_order_relaxed);
 }
 
 int TransTable::fetch(bitboard pos) {
-    if (transSize == 0) return Connect4::UNKNOWN;
+    if (bucketCount == 0) return Connect4::UNKNOWN;
 
-    //TODO: confirm bitboard -> entry conversion
-    int index = (pos % transSize)*2;
-    entry key = pos >> indexSize;
-    entry first = table[index];
-    if ((first & keyMask) == key) {
-        return (first & scoreMask) >> keySize;
+    COUNT(probes);
+    entry key;
+    std::atomic<entry>* bucket = getBucket(pos, key);
+    bool full = true;
+    for (int i = 0; i < ways; i++) {
+        entry e = bucket[i].load(std::memory_order_relaxed);
+        if ((e & SCORE_MASK) == 0) {
+            full = false;
+        } else if ((e >> KEY_SHIFT) == key) {
+            COUNT(hits[i]);
+            return e & SCORE_MASK;
+        }
+    }
+    if (full) {
+        COUNT(collisions);
     }
-    entry second = table[index + 1];
-    if ((second & keyMask) == key) {
-        return (second & scoreMask) >> keySize;
+
+    if (cold != NULL) {
+        int work;
+        int score = cold->fetch(pos, work);
+        if (score != Connect4::UNKNOWN) {
+            //back to the table so that the next probe does not have to go to disk
+            store(pos, score, (uint64_t) 1 << work);
+            return score;
+        }
     }
     return Connect4::UNKNOWN;
 }
+
+/**
+ * Odd numbers have a multiplicative inverse modulo a power of two, each Newton
+ * step doubles the number of correct low bits
+ */
+static entry inverse(entry odd) {
+    entry x = odd;
+    for (int i = 0; i < 5; i++) {
+        x *= 2 - odd * x;
+    }
+    return x;
+}
+
+bitboard TransTable::getPosition(const std::atomic<entry>* bucket, entry key) const {
+    static const entry INVERSE_MULTIPLIER = inverse(HASH_MULTIPLIER);
+    entry hash = ((entry) ((bucket - table) / ways) << keySize) | key;
+    return (hash * INVERSE_MULTIPLIER) & hashMask;
+}
+
+TransStats TransTable::getStats(bool histograms) const {
+    TransStats stats;
+    memset(&stats, 0, sizeof (stats));
+    stats.stores = stored.load(std::memory_order_relaxed);
+#if TRANS_STATS_ON
+    uint64_t hitCount = 0;
+    for (int t = 0; t < STATS_SLOTS; t++) {
+        const ThreadStats& counters = threadStats[t];
+        stats.probes += counters.probes.load(std::memory_order_relaxed);
+        for (int i = 0; i < TransStats::MAX_WAYS; i++) {
+            uint64_t h = counters.hits[i].load(std::memory_order_relaxed);
+            stats.hits[i] += h;
+            hitCount += h;
+        }
+        stats.collisions += counters.collisions.load(std::memory_order_relaxed);
+        stats.updates += counters.updates.load(std::memory_order_relaxed);
+        stats.inserts += counters.inserts.load(std::memory_order_relaxed);
+        stats.replacements += counters.replacements.load(std::memory_order_relaxed);
+        stats.exactOverwrites += counters.exactOverwrites.load(std::memory_order_relaxed);
+    }
+    stats.misses = stats.probes - hitCount;
+#endif
+
+    if (histograms) {
+        for (uint64_t b = 0; b < bucketCount; b++) {
+            int occupied = 0;
+            for (int i = 0; i < ways; i++) {
+                entry e = table[b * ways + i].load(std::memory_order_relaxed);
+                if ((e & SCORE_MASK) != 0) {
+                    occupied++;
+                    stats.work[(e >> WORK_SHIFT) & WORK_MASK]++;
+                }
+            }
+            stats.occupancy[occupied]++;
+        }
+    }
+    return stats;
+}
@@ -1,35 +1,187 @@
 #ifndef TRANS_TABLE_H
 #define TRANS_TABLE_H
 
+#include <atomic>
+#include <string>
 #include "connect4.h"
+#include "coldtier.h"
+
+//counts probes and replacements, each thread in counters of its own
+#ifndef TRANS_STATS_ON
+#define TRANS_STATS_ON 1
+#endif
 
 typedef uint64_t entry;
 
+/**
+ * Counters of a transposition table. The histograms are filled in by scanning the
+ * table, the rest is counted as the table is used.
+ */
+struct TransStats {
+    static const int MAX_WAYS = 8;
+    static const int WORK_LEVELS = 64;
+
+    uint64_t probes;
+    //hits by the slot of the bucket they were found in
+    uint64_t hits[MAX_WAYS];
+    uint64_t misses;
+    //misses in a bucket that was full of other positions
+    uint64_t collisions;
+    uint64_t stores;
+    //stores that found the position already in the table
+    uint64_t updates;
+    uint64_t inserts;
+    //stores that evicted another position
+    uint64_t replacements;
+    //exact scores overwritten by an inexact one, whether of the same position or not
+    uint64_t exactOverwrites;
+    //buckets by the number of occupied slots
+    uint64_t occupancy[MAX_WAYS + 1];
+    //entries by log2 of the nodes searched to get the score
+    uint64_t work[WORK_LEVELS];
+};
+
+/**
+ * Every slot is one packed 64-bit word (key | generation | work | score) that is read
+ * and written atomically, so several search threads can share the same table without
+ * locking. A probe never sees the key of one position combined with the score of
+ * another. Concurrent stores to the same bucket may lose an entry, which only costs
+ * a re-search.
+ *
+ * The slots are grouped into buckets of 1, 2, 4 or 8 entries that are aligned so
+ * that a probe touches a single cache line. The number of buckets is a power of two.
+ *
+ * With a ColdTier attached, replaced entries that took enough work are spilled to
+ * it instead of being lost, and misses are looked up there.
+ */
 class TransTable {
-    entry* table;
+public:
+    static const int DEFAULT_WAYS = 8;
+    //log2 of the nodes an entry must have taken to be spilled to the cold tier
+    static const int DEFAULT_SPILL_WORK = 10;
+
+private:
+    static const int POSITION_BITS = BOARD_WIDTH * (BOARD_HEIGHT + 1);
+    static const entry HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
 
-    //the table size also acts as a hash function so preferably it should be a prime
-    unsigned int transSize;
-    
-    int indexSize;
+    //entry layout from the lowest bit up
+    static const int SCORE_BITS = 3;
+    static const int WORK_BITS = 6;
+    static const int GENERATION_BITS = 4;
+    static const int WORK_SHIFT = SCORE_BITS;
+    static const int GENERATION_SHIFT = WORK_SHIFT + WORK_BITS;
+    static const int KEY_SHIFT = GENERATION_SHIFT + GENERATION_BITS;
+    static const entry SCORE_MASK = (1 << SCORE_BITS) - 1;
+    static const entry WORK_MASK = (1 << WORK_BITS) - 1;
+    static const entry GENERATION_MASK = (1 << GENERATION_BITS) - 1;
+    //how much one generation of age weighs against one doubling of work
+    static const int AGE_WEIGHT = 2;
+
+    std::atomic<entry>* memory;
+    //the first bucket, aligned to a cache line
+    std::atomic<entry>* table;
+    //size of the mapping if the memory was allocated with mmap or mapped from a snapshot
+    uint64_t mappedBytes;
+    bool hugePages;
+
+    uint64_t bucketCount;
+    int ways;
     int keySize;
-    int keyScoreSize;
+    entry hashMask;
     entry keyMask;
-    entry scoreMask;
-    entry workMask;
-    uint64_t maxWork;
+    unsigned int generation;
+    ColdTier* cold;
+    int spillWork;
 
-    uint64_t stored;
+    std::atomic<uint64_t> stored;
+#if TRANS_STATS_ON
+    static const int STATS_SLOTS = 64;
+
+    /**
+     * The counters of one thread. Only that thread writes them, so they are added
+     * to with a relaxed load and store instead of a locked add, and getStats sums
+     * them. Threads past STATS_SLOTS share slots and may lose a few counts. The
+     * padding keeps the counters of two threads off the same cache line.
+     */
+    typedef struct {
+        std::atomic<uint64_t> probes;
+        std::atomic<uint64_t> hits[TransStats::MAX_WAYS];
+        std::atomic<uint64_t> collisions;
+        std::atomic<uint64_t> updates;
+        std::atomic<uint64_t> inserts;
+        std::atomic<uint64_t> replacements;
+        std::atomic<uint64_t> exactOverwrites;
+        uint64_t padding[2];
+    } ThreadStats;
+
+    ThreadStats threadStats[STATS_SLOTS];
+#endif
+
+    void resetStats();
+    void init(int bucketBits);
+    void allocate(uint64_t bytes);
+
+    /**
+     * Multiplying by an odd constant is a bijection on the position bits, so the
+     * bucket index and the key together still identify the position exactly
+     */
+    std::atomic<entry>* getBucket(bitboard pos, entry& key) const {
+        entry hash = (pos * HASH_MULTIPLIER) & hashMask;
+        key = hash & keyMask;
+        return table + (hash >> keySize) * ways;
+    }
+
+    //the inverse of getBucket
+    bitboard getPosition(const std::atomic<entry>* bucket, entry key) const;
 
 public:
-    TransTable(unsigned int size);
+    /**
+     * The size is the total number of entries. It is rounded down to a power of two
+     * and 0 disables the table.
+     */
+    TransTable(uint64_t size, int ways = DEFAULT_WAYS);
+    TransTable(const std::string& file);
     ~TransTable();
     void reset();
+    void save(const std::string& file);
     void store(bitboard pos, unsigned int score, uint64_t work);
     int fetch(bitboard pos);
 
+    /**
+     * Returns the counters since the last reset. With histograms the whole table is
+     * scanned, which should not be done while other threads are storing to it.
+     */
+    TransStats getStats(bool histograms = true) const;
+
+    //evicted entries with at least minWork go to the tier, NULL for none
+    void setColdTier(ColdTier* tier, int minWork = DEFAULT_SPILL_WORK) {
+        cold = tier;
+        spillWork = minWork;
+    }
+
+    /**
+     * Entries from older generations are the first to be replaced. Should be called
+     * when the table is kept between searches.
+     */
+    void nextGeneration() {
+        generation = (generation + 1) & GENERATION_MASK;
+    }
+
     int getStored() {
-        return stored;
+        return stored.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getSize() const {
+        return bucketCount * ways;
+    }
+
+    int getWays() const {
+        return ways;
+    }
+
+    //true if the table is backed by pages reserved from hugetlbfs
+    bool usesHugePages() const {
+        return hugePages;
     }
 
 };